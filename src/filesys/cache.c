@@ -1,362 +1,1149 @@
 #include "filesys/cache.h"
 #include <string.h>
 #include <stdio.h>
+#include <hash.h>
+#include <round.h>
+#include <stdlib.h>
 #include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "devices/timer.h"
 
 struct list cache_list;
 
-struct lock cache_lock;
+/* All cache entries live in one array of cache_size slots,
+  allocated once in cache_init(), so loading or evicting a
+  sector never goes through the allocator. Unused slots are
+  kept in cache_free_list. */
+static struct cache_e *cache_slots;
+static size_t cache_size;
+static struct list cache_free_list;
+
+/* Each entry caches cache_block_sectors contiguous sectors,
+  starting at a multiple of cache_block_sectors, and reads and
+  writes them together. Their data lives in cache_data, one
+  buffer per slot, so an entry of CACHE_BLOCK_MAX sectors is
+  exactly one page. */
+static size_t cache_block_sectors;
+static uint8_t *cache_data;
+
+/* Index of cache_list by sector_idx, so that a hit doesn't
+  have to walk the whole list while holding cache_lock.
+  The number of buckets is fixed in cache_init(); hash.c would
+  rehash, and so malloc, every time an eviction made the entry
+  count cross a power of two. */
+static struct list *cache_buckets;
+static size_t cache_bucket_cnt;
 
-bool cache_checker[64];
+/* Replacement policy chosen at boot, and the clock hand into
+  cache_list that CACHE_CLOCK sweeps with. */
+static enum cache_policy cache_policy;
+static struct list_elem *clock_hand;
+
+static const char *cache_policy_names[CACHE_POLICY_CNT] =
+  {
+    [CACHE_CLOCK] = "clock",
+    [CACHE_LRU] = "lru",
+  };
 
-struct list read_ahead_list;
+/* Entries in use of each class, and how many metadata entries
+  are protected from eviction. */
+static size_t cache_class_cnt[CACHE_CLASS_CNT];
+static size_t cache_meta_max;
+
+static const char *cache_class_names[CACHE_CLASS_CNT] =
+  {
+    [CACHE_DATA] = "data",
+    [CACHE_INODE] = "inode",
+    [CACHE_INDEX] = "index",
+    [CACHE_DIR] = "directory",
+    [CACHE_FREE_MAP] = "free-map",
+  };
+
+/* Counters for cache_print_stats() and cache_get_stats().
+  Updated with cache_lock held. */
+static struct cache_stats cache_stats;
+static int64_t cache_lock_wait_ticks;
+
+struct lock cache_lock;
+
+/* Sectors queued for the read aheader, in a ring of
+  READ_AHEAD_QUEUE entries. Requests that don't fit are dropped,
+  read-ahead being only a hint. read_ahead_sema counts the queued
+  sectors, so the read aheader sleeps until there is work. */
+#define READ_AHEAD_QUEUE 256
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static size_t read_ahead_head;
+static size_t read_ahead_cnt;
+static struct semaphore read_ahead_sema;
 
 struct lock read_ahead_lock;
 
-/* Initialize cache_list, cache_lock (not yet!)
-  This code will be implanted in init.c  
+/* Dirty entries, in the order they became dirty. */
+static struct list cache_dirty_list;
+static size_t cache_dirty_cnt;
+
+/* Flush thread tunables; see cache_flush_configure(). */
+static int64_t flush_interval = 100;
+static int64_t flush_age = 500;
+static size_t flush_dirty_max;
+
+/* Wakes the flush thread when the cache stops being clean. */
+static struct semaphore flush_sema;
+
+/* The flush thread, and whether the dirty count has reached
+  flush_dirty_max since it last looked. */
+static struct thread *flush_thread;
+static bool flush_urgent;
+
+/* Most entries cache_flush_dirty() writes back at once. */
+#define FLUSH_BATCH 64
+
+/* Signaled when an entry's pin_cnt drops to zero. */
+static struct condition cache_unpinned;
+
+static struct list *cache_bucket(block_sector_t);
+static block_sector_t cache_block_start(block_sector_t);
+static void cache_block_io(struct cache_e *, bool write);
+static struct cache_e *cache_choose_victim(void);
+static void cache_entry_write(struct cache_e *);
+static void cache_write_begin(struct cache_e *);
+static void cache_write_end(struct cache_e *);
+static void cache_fill_done(struct cache_e *);
+static void cache_bench_read(block_sector_t, void *);
+static void clock_ticking(void);
+
+/* Initialize the buffer cache with room for SECTORS sectors,
+  cached BLOCK_SECTORS at a time and replaced according to POLICY.
+  BLOCK_SECTORS must be a power of two no larger than
+  CACHE_BLOCK_MAX.
+  This is called in init.c, before filesys_init().
   */
 void
-cache_init(void)
+cache_init(size_t sectors, size_t block_sectors, enum cache_policy policy)
 {
-  memset(cache_checker, false, sizeof(cache_checker));
+  ASSERT(block_sectors > 0 && block_sectors <= CACHE_BLOCK_MAX);
+  ASSERT((block_sectors & (block_sectors - 1)) == 0);
+  cache_block_sectors = block_sectors;
+  cache_size = DIV_ROUND_UP(sectors, block_sectors);
+  if(cache_size < CACHE_MIN_ENTRIES)
+    PANIC("Buffer cache must hold at least %d entries", CACHE_MIN_ENTRIES);
+  size_t slot_pages = DIV_ROUND_UP(cache_size * sizeof *cache_slots, PGSIZE);
+  size_t data_pages = DIV_ROUND_UP(cache_size * block_sectors
+                                   * BLOCK_SECTOR_SIZE, PGSIZE);
+  cache_slots = palloc_get_multiple(PAL_ZERO, slot_pages);
+  cache_data = palloc_get_multiple(0, data_pages);
+  if(cache_slots == NULL || cache_data == NULL)
+    PANIC("Buffer cache of %zu sectors doesn't fit in kernel memory", sectors);
+  cache_policy = policy;
+  clock_hand = NULL;
+  cache_meta_max = cache_size * CACHE_META_PCT / 100;
+
   list_init(&cache_list);
-  list_init(&read_ahead_list);
+  list_init(&cache_free_list);
+  for(size_t i = 0; i < cache_size; i++)
+  {
+    cache_slots[i].slot_idx = i;
+    cache_slots[i].buf = (char *) cache_data
+                         + i * block_sectors * BLOCK_SECTOR_SIZE;
+    cond_init(&cache_slots[i].io_done);
+    list_push_back(&cache_free_list, &cache_slots[i].elem);
+  }
+
+  /* About one entry per bucket. The bucket count is a power of
+    two so cache_bucket() can mask instead of divide. */
+  cache_bucket_cnt = 1;
+  while(cache_bucket_cnt < cache_size)
+    cache_bucket_cnt *= 2;
+  cache_buckets = malloc(cache_bucket_cnt * sizeof *cache_buckets);
+  if(cache_buckets == NULL)
+    PANIC("Failed to allocate buffer cache index");
+  for(size_t i = 0; i < cache_bucket_cnt; i++)
+    list_init(&cache_buckets[i]);
+
+  read_ahead_head = read_ahead_cnt = 0;
+  sema_init(&read_ahead_sema, 0);
+  list_init(&cache_dirty_list);
+  cache_dirty_cnt = 0;
+  /* flush_dirty_max is given in sectors but counts entries. */
+  flush_dirty_max = DIV_ROUND_UP(flush_dirty_max, block_sectors);
+  if(flush_dirty_max == 0 || flush_dirty_max > cache_size)
+    flush_dirty_max = (cache_size + 1) / 2;
+  sema_init(&flush_sema, 0);
+
   lock_init(&cache_lock);
+  cond_init(&cache_unpinned);
   lock_init(&read_ahead_lock);
   thread_create("cache_flush_thread", PRI_MIN, cache_flush_thread_func, NULL);
-  thread_create("read_aheader", PRI_MIN, read_aheader_func, NULL);
+  thread_create("read_aheader", PRI_DEFAULT, read_aheader_func, NULL);
+}
+
+/* Returns the bucket of the cache index that SECTOR_IDX
+  hashes to. */
+static struct list *
+cache_bucket(block_sector_t sector_idx)
+{
+  return &cache_buckets[hash_int(sector_idx) & (cache_bucket_cnt - 1)];
+}
+
+/* Returns the first sector of the cache block that holds
+  SECTOR_IDX. */
+static block_sector_t
+cache_block_start(block_sector_t sector_idx)
+{
+  return sector_idx & ~(block_sector_t) (cache_block_sectors - 1);
+}
+
+/* Returns where the data of SECTOR_IDX is in CACHE_ENTRY, which
+  must be the entry cache_load() returned for it. */
+void *
+cache_sector_data(struct cache_e *cache_entry, block_sector_t sector_idx)
+{
+  ASSERT(cache_block_start(sector_idx) == cache_entry->sector_idx);
+  return cache_entry->buf
+         + (sector_idx - cache_entry->sector_idx) * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads or writes, according to WRITE, the sectors CACHE_ENTRY
+  caches, back to back. The last block of a device whose size
+  isn't a multiple of cache_block_sectors is cut short. */
+static void
+cache_block_io(struct cache_e *cache_entry, bool write)
+{
+  block_sector_t sector_idx = cache_entry->sector_idx;
+  block_sector_t end = block_size(fs_device);
+  char *buf = cache_entry->buf;
+
+  for(size_t i = 0; i < cache_block_sectors && sector_idx < end; i++)
+  {
+    if(write)
+      block_write(fs_device, sector_idx, buf);
+    else
+      block_read(fs_device, sector_idx, buf);
+    sector_idx++;
+    buf += BLOCK_SECTOR_SIZE;
+  }
+}
+
+/* Returns the policy whose name is NAME, or CACHE_POLICY_CNT if
+  there is no such policy. */
+enum cache_policy
+cache_policy_by_name(const char *name)
+{
+  int i;
+
+  for(i = 0; i < CACHE_POLICY_CNT; i++)
+    if(!strcmp(name, cache_policy_names[i]))
+      break;
+  return i;
 }
 
-/* Look up cache list and return the pointer to
-  cache_e that corresponds to given sector number
+/* Returns the number of sectors the cache can hold. */
+size_t
+cache_capacity(void)
+{
+  return cache_size * cache_block_sectors;
+}
+
+/* Look up cache index and return the pointer to
+  cache_e that caches given sector number
   */
 struct cache_e *
 lookup_cache (block_sector_t sector_idx)
 {
-  struct list_elem *temp = NULL;
-  struct cache_e *result = NULL;
+  sector_idx = cache_block_start(sector_idx);
+  struct list *bucket = cache_bucket(sector_idx);
+  struct list_elem *temp;
 
-  /* Find the cache_e corresponding to the given sector_idx,
-  iterating the cache_list */
-  for(temp = list_begin(&cache_list);
-  temp != list_end(&cache_list) ; temp = list_next(temp))
+  for(temp = list_begin(bucket); temp != list_end(bucket);
+      temp = list_next(temp))
   {
-    result = list_entry(temp, struct cache_e, elem);
-    if(sector_idx == result->sector_idx)
-    {
-      return result;
-    }
+    struct cache_e *cache_entry = list_entry(temp, struct cache_e, bucket_elem);
+    if(cache_entry->sector_idx == sector_idx)
+      return cache_entry;
   }
   return NULL;
 }
 
-void
+/* Frees one slot, chosen by the replacement policy, and puts it
+  on the free list. Must be called with cache_lock held.
+
+  Only clean, unpinned entries are evicted on the spot. If the
+  victim is dirty, it is written back with cache_lock released
+  and false is returned; false is also returned after waiting
+  for an entry to be unpinned when every entry is in use. In
+  both cases the cache may have changed meanwhile, so the caller
+  has to look up its sector again before retrying. */
+bool
 cache_evict(void)
 {  
-  ASSERT(cache_find_empty_slot() == -1);
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+
+  struct cache_e *victim = cache_choose_victim();
+  if(victim == NULL)
+  {
+    cond_wait(&cache_unpinned, &cache_lock);
+    return false;
+  }
+
+  if(victim->dirty)
+  {
+    cache_entry_write(victim);
+    return false;
+  }
+
+  /* Keep the clock hand on cache_list. */
+  if(clock_hand == &victim->elem)
+    clock_ticking();
+  if(clock_hand == &victim->elem)
+    clock_hand = NULL;
+
+  list_remove(&victim->elem);
+  list_remove(&victim->bucket_elem);
+
+  victim->in_use = false;
+  cache_class_cnt[victim->class]--;
+  list_push_back(&cache_free_list, &victim->elem);
+  cache_stats.evictions++;
+  if(victim->read_ahead)
+    cache_stats.ra_wasted++;
+  return true;
+}
+
+/* Returns true if CACHE_ENTRY holds metadata and metadata is
+  within its share of the cache. */
+static bool
+cache_protected(struct cache_e *cache_entry)
+{
+  size_t meta_cnt = 0;
+
+  for(int i = 0; i < CACHE_CLASS_CNT; i++)
+    if(i != CACHE_DATA)
+      meta_cnt += cache_class_cnt[i];
+  return cache_entry->class != CACHE_DATA && meta_cnt <= cache_meta_max;
+}
+
+/* Returns true if CACHE_ENTRY may be evicted: nobody holds it,
+  it isn't being read or written and, unless ANY is true, it
+  isn't protected metadata. */
+static bool
+cache_evictable(struct cache_e *cache_entry, bool any)
+{
+  return (cache_entry->pin_cnt == 0 && cache_entry->state == CACHE_VALID
+          && (any || !cache_protected(cache_entry)));
+}
 
+/* Picks the entry to evict, or returns a null pointer if every
+  entry is in use. Both policies are O(1) per eviction (amortized,
+  for CACHE_CLOCK) as long as few entries are held at once.
+
+  File data goes first: protected metadata is only considered
+  once a pass over the cache found no other victim.
+
+  CACHE_LRU keeps cache_list in recency order, least recently
+  used at the front.
+
+  CACHE_CLOCK sweeps cache_list with clock_hand, giving each entry
+  that was accessed since the last sweep a second chance. */
+static struct cache_e *
+cache_choose_victim(void)
+{
   struct list_elem *temp;
-  struct cache_e *min = list_entry(list_begin(&cache_list), struct cache_e, elem);
-  
-  for(temp = list_begin(&cache_list);
-  temp != list_end(&cache_list); temp = list_next(temp))
+
+  ASSERT(!list_empty(&cache_list));
+
+  for(int any = 0; any < 2; any++)
   {
-    struct cache_e *compare = list_entry(temp, struct cache_e, elem);
-    if(compare->access_count < min->access_count)
+    if(cache_policy == CACHE_LRU)
+    {
+      for(temp = list_begin(&cache_list); temp != list_end(&cache_list);
+          temp = list_next(temp))
+      {
+        struct cache_e *cache_entry = list_entry(temp, struct cache_e, elem);
+        if(cache_evictable(cache_entry, any))
+          return cache_entry;
+      }
+      continue;
+    }
+
+    /* Two full sweeps clear every reference bit, so an entry would
+      have been found by then unless all of them are in use. */
+    for(size_t i = 0; i < 2 * cache_size + 1; i++)
     {
-      min = compare;
+      clock_ticking();
+      struct cache_e *cache_entry
+        = list_entry(clock_hand, struct cache_e, elem);
+      if(!cache_evictable(cache_entry, any))
+        continue;
+      if(!cache_entry->accessed)
+        return cache_entry;
+      cache_entry->accessed = false;
     }
   }
+  return NULL;
+}
+
+/* Advances clock_hand to the next entry of cache_list,
+  wrapping around at the end. */
+static void
+clock_ticking(void)
+{
+  if(clock_hand == NULL || clock_hand == list_rbegin(&cache_list))
+    clock_hand = list_begin(&cache_list);
+  else
+    clock_hand = list_next(clock_hand);
+}
 
-  cache_slot_set(min->slot_idx, false);
-  list_remove(&min->elem);
-  
-  if(min->dirty)
+/* Records an access to CACHE_ENTRY for the replacement policy. */
+static void
+cache_touch(struct cache_e *cache_entry)
+{
+  if(cache_policy == CACHE_LRU)
   {
-    block_write(fs_device, min->sector_idx, min->buf);
+    list_remove(&cache_entry->elem);
+    list_push_back(&cache_list, &cache_entry->elem);
   }
+  else
+    cache_entry->accessed = true;
+}
+
+/* Moves CACHE_ENTRY to the cold end of cache_list, where the
+  replacement policy looks first: the front for CACHE_LRU, right
+  after the hand, with its reference bit clear, for CACHE_CLOCK. */
+static void
+cache_make_cold(struct cache_e *cache_entry)
+{
+  struct list_elem *prev = list_prev(&cache_entry->elem);
 
-  free(min);
+  cache_entry->accessed = false;
+  if(clock_hand == &cache_entry->elem)
+    clock_hand = prev != list_head(&cache_list) ? prev : NULL;
+  list_remove(&cache_entry->elem);
+  if(cache_policy == CACHE_CLOCK && clock_hand != NULL)
+    list_insert(list_next(clock_hand), &cache_entry->elem);
+  else
+    list_push_front(&cache_list, &cache_entry->elem);
 }
 
+/* Takes a slot from cache_free_list and sets it up to hold the
+  block of SECTOR, in CACHE_LOADING state and held by the caller.
+  The caller must have made room with cache_evict(). */
 struct cache_e *
 cache_create(block_sector_t sector)
 {
-  int empty_slot_idx = cache_find_empty_slot();
-  if(empty_slot_idx == -1)
+  if(list_empty(&cache_free_list))
     PANIC("There is no empty slot in buffer cache\n");
 
-  struct cache_e *cache_entry = (struct cache_e *)malloc(sizeof(struct cache_e));
-  memset(cache_entry->buf, 0, sizeof(cache_entry->buf));
+  struct cache_e *cache_entry
+    = list_entry(list_pop_front(&cache_free_list), struct cache_e, elem);
+  cache_entry->in_use = true;
+  cache_entry->state = CACHE_LOADING;
+  cache_entry->pin_cnt = 1;
   cache_entry->dirty = false;
-  cache_entry->sector_idx = sector;
-  cache_entry->slot_idx = empty_slot_idx;
-  cache_entry->access_count = 0;
+  cache_entry->sector_idx = cache_block_start(sector);
+  cache_entry->accessed = false;
+  cache_entry->read_ahead = false;
+  cache_entry->class = CACHE_DATA;
+  cache_class_cnt[CACHE_DATA]++;
 
-  list_push_back(&cache_list, &cache_entry->elem);
-  cache_slot_set(empty_slot_idx, true);
+  /* A new entry goes where it will be looked at last: the MRU
+    end for CACHE_LRU, right behind the hand for CACHE_CLOCK. */
+  if(cache_policy == CACHE_CLOCK && clock_hand != NULL)
+    list_insert(clock_hand, &cache_entry->elem);
+  else
+    list_push_back(&cache_list, &cache_entry->elem);
+  list_push_back(cache_bucket(cache_entry->sector_idx),
+                 &cache_entry->bucket_elem);
 
   return cache_entry;
 }
 
-
-struct cache_e *
-cache_load(block_sector_t sector_idx)
+/* Moves CACHE_ENTRY, if it is still in CACHE_LOADING state, to
+  CACHE_VALID, now that its data is in place, and wakes the
+  threads waiting for it. Must be called with cache_lock held. */
+static void
+cache_fill_done(struct cache_e *cache_entry)
 {
-  //Flag for it is waited for aheader
-  bool waited_for_aheader = false;
+  if(cache_entry->state != CACHE_LOADING)
+    return;
+  cache_entry->state = CACHE_VALID;
+  cond_broadcast(&cache_entry->io_done, &cache_lock);
+}
 
-  /* Look whether there is read_ahead_e for this sector. If it is,
-    wait until the read aheader finishes reading. After reading,
-    there would be new cache_e for that sector, so no further fetching
-    would occur.
-    */
-  read_ahead_acquire();
-  struct read_ahead_e *read_ahead_entry = lookup_ra_list(sector_idx);
-  if(read_ahead_entry != NULL)
-  {
-    sema_down(&read_ahead_entry->sector_sema);
-    waited_for_aheader = true;
-  }
-  read_ahead_release();
+/* Returns the entry for SECTOR_IDX, reading its whole block from
+  disk if it isn't cached, and holds it for the caller. A demand
+  access tags the entry with CLASS, unless CLASS is CACHE_CLASS_CNT,
+  which leaves the entry's class as it was. AHEAD tells whether this is
+  read-ahead rather than a demand access; read-ahead only ever
+  fetches file data, and isn't counted as a hit or miss.
 
-  cache_acquire();
-  struct cache_e *cache_entry = lookup_cache(sector_idx);
+  cache_lock is only held to look up and reserve the entry. The
+  disk read happens with it released, so a miss doesn't delay
+  hits on other sectors. The index doubles as the table of reads
+  in flight: threads that want the same sector meanwhile find it
+  in CACHE_LOADING state and wait for that read instead of issuing
+  their own, so concurrent misses on a sector cost one read.
 
-  if(cache_entry == NULL)
+  Read-ahead never waits: if the sector is cached or in flight,
+  returns a null pointer right away.
+
+  FRESH tells that the caller will overwrite the whole sector, so
+  its old contents don't matter. A missing entry that holds only
+  this sector is then not read from disk at all, and the miss
+  isn't counted, since it costs no read. It stays in CACHE_LOADING
+  state until the caller has filled it in and calls
+  cache_mark_dirty() or cache_unpin(), so that a thread that finds
+  it meanwhile waits for the new data instead of seeing the sector
+  it last held. */
+static struct cache_e *
+cache_get(block_sector_t sector_idx, enum cache_class class, bool ahead,
+          bool fresh)
+{
+  struct cache_e *cache_entry;
+
+  cache_acquire();
+  while(true)
   {
-    if(cache_find_empty_slot() == -1)
+    cache_entry = lookup_cache(sector_idx);
+    if(cache_entry != NULL && ahead)
     {
-      cache_evict();
+      cache_release();
+      return NULL;
     }
-    cache_entry = cache_create(sector_idx);
-    block_read(fs_device, sector_idx, cache_entry->buf);
-  }
-  cache_entry->access_count++;
-  cache_release();
+    if(cache_entry != NULL)
+    {
+      cache_entry->pin_cnt++;
+      if(cache_entry->state == CACHE_LOADING)
+        cache_stats.coalesced++;
+      while(cache_entry->state == CACHE_LOADING)
+        cond_wait(&cache_entry->io_done, &cache_lock);
+      if(!ahead)
+      {
+        cache_stats.hits++;
+        if(cache_entry->read_ahead)
+        {
+          cache_entry->read_ahead = false;
+          cache_stats.ra_used++;
+        }
+      }
+      break;
+    }
+    if(!list_empty(&cache_free_list) || cache_evict())
+    {
+      cache_entry = cache_create(sector_idx);
+      cache_entry->read_ahead = ahead;
+      fresh = fresh && cache_block_sectors == 1;
+      if(ahead)
+        cache_stats.ra_issued++;
+      else if(!fresh)
+        cache_stats.misses++;
+      cache_release();
 
-  /* Read Ahead!
-    Make rae only when there is same rae in list.
-  */
-  read_ahead_acquire();
-  if(lookup_ra_list(sector_idx+1) == NULL)
+      if(!fresh)
+        cache_block_io(cache_entry, false);
+
+      cache_acquire();
+      if(!fresh)
+        cache_fill_done(cache_entry);
+      break;
+    }
+  }
+  if(!ahead && class != CACHE_CLASS_CNT)
   {
-    struct read_ahead_e * new_rae = rae_create(sector_idx+1); //here
-    sema_down(&new_rae->sector_sema);
+    cache_class_cnt[cache_entry->class]--;
+    cache_entry->class = class;
+    cache_class_cnt[class]++;
   }
-  read_ahead_release();
+  cache_touch(cache_entry);
+  cache_release();
 
   return cache_entry;
 }
 
+/* Returns the entry for SECTOR_IDX, which holds data of CLASS,
+  with its data read in; use cache_sector_data() to find the
+  sector in it. The entry is held, so it won't be evicted, until
+  the caller passes it to cache_unpin(). */
+struct cache_e *
+cache_load(block_sector_t sector_idx, enum cache_class class)
+{
+  return cache_get(sector_idx, class, false, false);
+}
+
+/* Pins SECTOR_IDX in the cache and returns a pointer to its data,
+  so that callers can read or change it in place instead of
+  copying the sector out. The pointer stays valid until the caller
+  passes *CACHE_ENTRY to cache_unpin(). A caller that changes the
+  data must call cache_mark_dirty(*CACHE_ENTRY) before that. */
+void *
+cache_pin(block_sector_t sector_idx, enum cache_class class,
+          struct cache_e **cache_entry)
+{
+  *cache_entry = cache_load(sector_idx, class);
+  return cache_sector_data(*cache_entry, sector_idx);
+}
+
+/* Same as cache_pin(), for a caller that is about to overwrite
+  all of SECTOR_IDX, such as a whole-sector write or a sector just
+  allocated: the sector isn't read from disk first, unless the rest
+  of its cache block has to be. Its data is undefined until the
+  caller fills it in; threads that want the sector meanwhile wait
+  until the caller marks it dirty or unpins it. */
+void *
+cache_pin_new(block_sector_t sector_idx, enum cache_class class,
+              struct cache_e **cache_entry)
+{
+  *cache_entry = cache_get(sector_idx, class, false, true);
+  return cache_sector_data(*cache_entry, sector_idx);
+}
+
+/* Fills SECTOR_IDX, which holds data of CLASS, with zeros in the
+  cache, without reading it first; the zeros reach the disk when
+  the sector is written back like any other change. */
+void
+cache_zero(block_sector_t sector_idx, enum cache_class class)
+{
+  struct cache_e *cache_entry;
+  memset(cache_pin_new(sector_idx, class, &cache_entry), 0,
+         BLOCK_SECTOR_SIZE);
+  cache_mark_dirty(cache_entry);
+  cache_unpin(cache_entry);
+}
+
+/* Lets go of CACHE_ENTRY, which the caller got from cache_load(),
+  so it may be evicted again. */
+void
+cache_unpin(struct cache_e *cache_entry)
+{
+  cache_acquire();
+  ASSERT(cache_entry->pin_cnt > 0);
+  cache_fill_done(cache_entry);
+  if(--cache_entry->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
+  cache_release();
+}
+
+
+/* Same as cache_unpin(), for a reader that won't need CACHE_ENTRY
+  again, such as one streaming through a large file. The entry is
+  made the next candidate for eviction, so streaming doesn't push
+  out the sectors other threads keep using. */
+void
+cache_unpin_cold(struct cache_e *cache_entry)
+{
+  cache_acquire();
+  ASSERT(cache_entry->pin_cnt > 0);
+  cache_fill_done(cache_entry);
+  cache_make_cold(cache_entry);
+  if(--cache_entry->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
+  cache_release();
+}
 
 /* cache load function for read aheader
-  Just read from the block to the sector. This will not be
-  interrupted because the sema for this rae is 0, so any other
-  request to read this sector will be blocked.
+  Just read from the block to the sector. A reader that asks for
+  the sector meanwhile finds it loading and waits for this read
+  instead of issuing its own. If the sector is already cached or
+  being read, returns false at once rather than waiting for it,
+  so the read aheader can go on to the next one.
  */
-struct cache_e *
+bool
 cache_load_ahead(block_sector_t sector_idx)
 {
-  cache_acquire();
-  struct cache_e *cache_entry = lookup_cache(sector_idx);
-
+  struct cache_e *cache_entry = cache_get(sector_idx, CACHE_DATA, true, false);
   if(cache_entry == NULL)
+    return false;
+
+  //Access count will be increased by the requesting thread
+  cache_unpin(cache_entry);
+  return true;
+}
+
+/* Marks CACHE_ENTRY, which the caller holds and has just
+  changed, as dirty. The first change since its last write-back
+  puts it at the back of cache_dirty_list and starts its age.
+  Wakes the flush thread when the cache stops being clean, and
+  cuts its sleep short when the dirty count reaches
+  flush_dirty_max. */
+void
+cache_mark_dirty(struct cache_e *cache_entry)
+{
+  cache_acquire();
+  cache_fill_done(cache_entry);
+  if(!cache_entry->dirty)
   {
-    if(cache_find_empty_slot() == -1)
+    cache_entry->dirty = true;
+    cache_entry->dirty_tick = timer_ticks();
+    list_push_back(&cache_dirty_list, &cache_entry->dirty_elem);
+    cache_dirty_cnt++;
+    if(cache_dirty_cnt == 1)
+      sema_up(&flush_sema);
+    if(cache_dirty_cnt == flush_dirty_max)
     {
-      cache_evict();
+      flush_urgent = true;
+      if(flush_thread != NULL)
+        thread_wake(flush_thread);
     }
-    cache_entry = cache_create(sector_idx);
-    block_read(fs_device, sector_idx, cache_entry->buf);
   }
-  //Access count will be increased by the requesting thread
   cache_release();
-
-  return cache_entry;
 }
 
 /* Cache load for the data of Sector size, and write to the
   buffer, it doens't need to memcpy after cache_load.
+  This is write-back: the sector reaches the disk when it is
+  evicted, when the flush thread runs, or at cache_flush().
 */
 void
-cache_write_from_buf(block_sector_t sector, void* buffer)
+cache_write_from_buf(block_sector_t sector, enum cache_class class,
+                     void* buffer)
+{
+  struct cache_e* cache_entry = cache_load(sector, class);
+  memcpy(cache_sector_data(cache_entry, sector), buffer, BLOCK_SECTOR_SIZE);
+  cache_mark_dirty(cache_entry);
+  cache_unpin(cache_entry);
+}
+
+/* Same as cache_write_from_buf(), but also writes the sector to
+  disk before returning, for the few sectors that must not be
+  lost in a crash. */
+void
+cache_write_through(block_sector_t sector, enum cache_class class,
+                    void* buffer)
+{
+  struct cache_e* cache_entry = cache_load(sector, class);
+  memcpy(cache_sector_data(cache_entry, sector), buffer, BLOCK_SECTOR_SIZE);
+  cache_mark_dirty(cache_entry);
+  cache_write_back(cache_entry);
+  cache_unpin(cache_entry);
+}
+
+/* Writes CACHE_ENTRY, which the caller holds, to disk now if it
+  is dirty. */
+void
+cache_write_back(struct cache_e *cache_entry)
+{
+  cache_acquire();
+  /* A write already in progress may have started before the
+    caller's changes, so wait for it and check again. */
+  while(cache_entry->state == CACHE_WRITING)
+    cond_wait(&cache_entry->io_done, &cache_lock);
+  if(cache_entry->dirty)
+    cache_entry_write(cache_entry);
+  cache_release();
+}
+
+/* Writes dirty CACHE_ENTRY to disk, with cache_lock released
+  during the write. Must be called with cache_lock held. */
+static void
+cache_entry_write(struct cache_e *cache_entry)
+{
+  cache_write_begin(cache_entry);
+  cache_release();
+
+  cache_block_io(cache_entry, true);
+
+  cache_acquire();
+  cache_write_end(cache_entry);
+}
+
+/* Prepares dirty CACHE_ENTRY to be written back with cache_lock
+  released. Must be called with cache_lock held.
+
+  The entry is held and in CACHE_WRITING state until
+  cache_write_end(), so it can't be evicted; it can still be read
+  and written. It is marked clean before the write starts, so a
+  change made during the write leaves it dirty for the next one. */
+static void
+cache_write_begin(struct cache_e *cache_entry)
 {
-  struct cache_e* cache_entry = cache_load(sector);
-  memcpy(cache_entry->buf, buffer, BLOCK_SECTOR_SIZE);
-  cache_entry->dirty = true;
-  block_write(fs_device, sector, buffer);
+  ASSERT(cache_entry->state == CACHE_VALID);
+  ASSERT(cache_entry->dirty);
+
+  cache_entry->pin_cnt++;
+  cache_entry->state = CACHE_WRITING;
+  cache_entry->dirty = false;
+  list_remove(&cache_entry->dirty_elem);
+  cache_dirty_cnt--;
+  cache_stats.write_backs++;
+}
+
+/* Finishes a write started by cache_write_begin(). Must be
+  called with cache_lock held. */
+static void
+cache_write_end(struct cache_e *cache_entry)
+{
+  cache_entry->state = CACHE_VALID;
+  if(--cache_entry->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
+  cond_broadcast(&cache_entry->io_done, &cache_lock);
 }
 
 void
-cache_read_from_buf(block_sector_t sector, void* buffer)
+cache_read_from_buf(block_sector_t sector, enum cache_class class,
+                    void* buffer)
 {
-  struct cache_e* cache_entry = cache_load(sector);
-  memcpy(buffer, cache_entry->buf, BLOCK_SECTOR_SIZE);
+  struct cache_e* cache_entry = cache_load(sector, class);
+  memcpy(buffer, cache_sector_data(cache_entry, sector), BLOCK_SECTOR_SIZE);
+  cache_unpin(cache_entry);
 }
 
 /* Functions for cache_flush */
+
+/* Sets how the flush thread behaves: it checks for old dirty
+  sectors every INTERVAL_MS milliseconds while the cache is dirty,
+  writes back sectors that have been dirty for MAX_AGE_MS, and
+  starts writing back early once DIRTY_MAX sectors are dirty (0
+  means half the cache). Called from init.c before cache_init(). */
 void
-cache_flush(void)
+cache_flush_configure(int interval_ms, int max_age_ms, size_t dirty_max)
 {
+  if(interval_ms > 0)
+    flush_interval = interval_ms;
+  if(max_age_ms >= 0)
+    flush_age = max_age_ms;
+  flush_dirty_max = dirty_max;
+}
+
+/* Orders cache entries by sector number, for qsort(). */
+static int
+cache_sector_cmp(const void *a_, const void *b_)
+{
+  const struct cache_e *a = *(struct cache_e * const *) a_;
+  const struct cache_e *b = *(struct cache_e * const *) b_;
+  return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Writes back dirty entries, oldest first, in batches of up to
+  FLUSH_BATCH. If ALL is true, writes every dirty entry.
+  Otherwise writes the entries that have been dirty for
+  flush_age, and, if flush_dirty_max entries are dirty, keeps
+  writing until only half that many are left.
+
+  Each batch is sorted by sector, so the disk sees it as one
+  ascending sweep, and written with cache_lock released. */
+static void
+cache_flush_dirty(bool all)
+{
+  struct cache_e *batch[FLUSH_BATCH];
+  int64_t age_ticks = flush_age * TIMER_FREQ / 1000;
+
   cache_acquire();
-  struct list_elem *temp = NULL;
-  for(temp = list_begin(&cache_list);
-  temp != list_end(&cache_list); temp = list_next(temp))
+  bool over = cache_dirty_cnt >= flush_dirty_max;
+  while(true)
   {
-    struct cache_e *cache_entry = list_entry(temp, struct cache_e, elem);
-    if(cache_entry->dirty)
+    size_t cnt = 0;
+    struct list_elem *temp = list_begin(&cache_dirty_list);
+
+    while(cnt < FLUSH_BATCH && temp != list_end(&cache_dirty_list))
     {
-      block_write(fs_device, cache_entry->sector_idx, cache_entry->buf);
-      cache_entry->dirty = false;
+      struct cache_e *cache_entry
+        = list_entry(temp, struct cache_e, dirty_elem);
+      if(!all && !(over && cache_dirty_cnt > flush_dirty_max / 2)
+         && timer_elapsed(cache_entry->dirty_tick) < age_ticks)
+        break;
+
+      temp = list_next(temp);
+      /* Changed again while another thread writes it back. */
+      if(cache_entry->state != CACHE_VALID)
+        continue;
+      cache_write_begin(cache_entry);
+      batch[cnt++] = cache_entry;
     }
+
+    if(cnt == 0)
+    {
+      /* Whatever is left is being written by someone else. To
+        write everything, wait for that and look again. */
+      if(!all || list_empty(&cache_dirty_list))
+        break;
+      struct cache_e *cache_entry = list_entry(list_front(&cache_dirty_list),
+                                               struct cache_e, dirty_elem);
+      cond_wait(&cache_entry->io_done, &cache_lock);
+      continue;
+    }
+
+    cache_release();
+    qsort(batch, cnt, sizeof *batch, cache_sector_cmp);
+    for(size_t i = 0; i < cnt; i++)
+      cache_block_io(batch[i], true);
+    cache_acquire();
+
+    for(size_t i = 0; i < cnt; i++)
+      cache_write_end(batch[i]);
   }
   cache_release();
 }
 
+/* Writes back every dirty entry. */
+void
+cache_flush(void)
+{
+  cache_flush_dirty(true);
+}
+
+/* Flush thread. While the cache is clean it sleeps on flush_sema,
+  which cache_mark_dirty() ups. While there are dirty entries it
+  wakes every flush_interval milliseconds, or as soon as
+  cache_mark_dirty() sees flush_dirty_max of them, and writes back
+  those that are due. */
 void
 cache_flush_thread_func(void* aux UNUSED)
 {
+  int64_t interval_ticks;
+
+  flush_thread = thread_current();
   while(true)
   {
-    timer_msleep(100);
-    cache_flush();
+    cache_acquire();
+    bool clean = cache_dirty_cnt == 0;
+    cache_release();
+
+    if(clean)
+      sema_down(&flush_sema);
+    else
+    {
+      /* With interrupts off, cache_mark_dirty() can't set
+        flush_urgent between the test and the sleep. */
+      enum intr_level old_level = intr_disable();
+      interval_ticks = flush_interval * TIMER_FREQ / 1000;
+      if(interval_ticks == 0)
+        interval_ticks = 1;
+      if(!flush_urgent)
+        thread_sleep(timer_ticks() + interval_ticks);
+      flush_urgent = false;
+      intr_set_level(old_level);
+    }
+
+    /* This pass covers whatever ups came in since the last. */
+    while(sema_try_down(&flush_sema))
+      continue;
+    cache_flush_dirty(false);
   }
 }
 
-/* Function for read ahead list flush 
-  It flushes the read ahead list in filesys_done.
-  */
+/* Queues SECTOR_IDX to be read into the cache by the read
+  aheader, and returns without waiting for it. A sector in the
+  same cache block as the last one queued is already covered. */
 void
-ra_list_flush(void)
+cache_read_ahead(block_sector_t sector_idx)
 {
   read_ahead_acquire();
-  while(!list_empty(&read_ahead_list))
+  if(read_ahead_cnt > 0)
   {
-    struct list_elem *temp = list_pop_front(&read_ahead_list);
-    struct read_ahead_e *read_ahead_entry = list_entry(temp, struct read_ahead_e, elem);
-    free(read_ahead_entry);
+    block_sector_t last = read_ahead_queue[(read_ahead_head + read_ahead_cnt
+                                            - 1) % READ_AHEAD_QUEUE];
+    if(cache_block_start(last) == cache_block_start(sector_idx))
+    {
+      read_ahead_release();
+      return;
+    }
+  }
+  if(read_ahead_cnt < READ_AHEAD_QUEUE)
+  {
+    read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE]
+      = sector_idx;
+    read_ahead_cnt++;
+    sema_up(&read_ahead_sema);
   }
   read_ahead_release();
 }
 
+/* Function for read ahead queue flush
+  It drops the queued requests in filesys_done. read_ahead_sema
+  is left as it is; the read aheader just finds nothing queued.
+  */
+void
+read_ahead_flush(void)
+{
+  read_ahead_acquire();
+  read_ahead_cnt = 0;
+  read_ahead_release();
+}
+
 /* Function for read aheader 
-  This is thread that read the sector by cache_load_ahead
-  It sweeps the list and load the sectors in read ahead list.
-  After read, it just removes the list element. Therefore, the
-  remaining read_ahead_e has to be removed by afterward request,
-  or when the filesys is done.
+  This is thread that read the sector by cache_load_ahead.
+  It sleeps on read_ahead_sema until cache_read_ahead() queues
+  a sector, then loads the queued sectors in order.
   */
 void
 read_aheader_func(void *aux UNUSED)
 {
   while(true)
   {
-    timer_msleep(50);
-    if(!list_empty(&read_ahead_list))
+    sema_down(&read_ahead_sema);
+
+    read_ahead_acquire();
+    if(read_ahead_cnt == 0)
     {
-      struct read_ahead_e *read_ahead_entry = 
-      list_entry(list_front(&read_ahead_list), struct read_ahead_e, elem);
-      cache_load_ahead(read_ahead_entry->sector_idx);
-      
-      list_remove(&read_ahead_entry->elem);
-
-      /* There might be many threads that are waiting for this sector
-        So, we need to sema_up all of them.
-      */
-      while(!list_empty(&read_ahead_entry->sector_sema.waiters))
-        sema_up(&read_ahead_entry->sector_sema);
-      
-      /* After unblocking the whole waiting thread, they will read
-      from cache, so just free the entry
-      */
-      free(read_ahead_entry);
+      read_ahead_release();
+      continue;
     }
+    block_sector_t sector_idx = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+    read_ahead_cnt--;
+    read_ahead_release();
+
+    cache_load_ahead(sector_idx);
   }
 }
 
-/* Function for read ahead list */
+/* Functions for lock */
 
-/* This function looks up read ahead list and get the
-  entry corresponding to the sector_idx 
-  Maybe it has to be synchronized with other
-  list modifying functions, such as rae_create or list_remove.
-  */
-struct read_ahead_e *
-lookup_ra_list(block_sector_t sector_idx)
+/* Acquires cache_lock, timing the wait if another thread holds
+  it. The timer only counts ticks, so waits shorter than a tick
+  count as contention but add little to lock_wait_ms. */
+void
+cache_acquire()
 {
-  struct list_elem *temp;
-  for(temp = list_begin(&read_ahead_list);
-  temp != list_end(&read_ahead_list); temp = list_next(temp))
+  if(lock_try_acquire(&cache_lock))
+    cache_stats.lock_acquires++;
+  else
   {
-    struct read_ahead_e *read_ahead_entry = list_entry(temp, struct read_ahead_e, elem);
-    if(sector_idx == read_ahead_entry->sector_idx)
-    {
-      return read_ahead_entry;
-    }
+    int64_t start = timer_ticks();
+    lock_acquire(&cache_lock);
+    cache_lock_wait_ticks += timer_elapsed(start);
+    cache_stats.lock_acquires++;
+    cache_stats.lock_contended++;
   }
-  return NULL;
 }
 
-/* This function creates new read_ahead_e, when one thread
-  wants to prefetch the next sector in cache_load
-  */
-struct read_ahead_e *
-rae_create(block_sector_t sector_idx)
+void
+cache_release()
 {
-  struct read_ahead_e *read_ahead_entry = (struct read_ahead_e *)malloc(sizeof(struct read_ahead_e));
-  sema_init(&read_ahead_entry->sector_sema, 1);
-  read_ahead_entry->sector_idx = sector_idx;
-
-  list_push_back(&read_ahead_list, &read_ahead_entry->elem);
-
-  return read_ahead_entry;
+  lock_release(&cache_lock);
 }
 
-/* Functions for slot */
-int
-cache_find_empty_slot(void)
+void
+read_ahead_acquire()
 {
-  for(int i=0; i<64; i++)
-  {
-    if(cache_checker[i] == false)
-      return i;
-  }
-
-  return -1;
+  lock_acquire(&read_ahead_lock);
 }
 
 void
-cache_slot_set(int slot_idx, bool result)
+read_ahead_release()
 {
-  cache_checker[slot_idx] = result;
+  lock_release(&read_ahead_lock);
 }
 
-/* Functions for lock */
+/* Copies the cache counters into STATS. */
 void
-cache_acquire()
+cache_get_stats(struct cache_stats *stats)
 {
-  lock_acquire(&cache_lock);
+  cache_acquire();
+  *stats = cache_stats;
+  stats->lock_wait_ms = cache_lock_wait_ticks * 1000 / TIMER_FREQ;
+  cache_release();
 }
 
+/* Prints the buffer cache counters: the demand hit ratio, along
+  with the replacement policy that produced it, write-back and
+  read-ahead activity, and contention on cache_lock. */
 void
-cache_release()
+cache_print_stats(void)
 {
-  lock_release(&cache_lock);
+  struct cache_stats s = cache_stats;
+  long long accesses = s.hits + s.misses;
+
+  s.lock_wait_ms = cache_lock_wait_ticks * 1000 / TIMER_FREQ;
+  printf("Buffer cache (%s, %zu sectors): %lld hits, %lld misses, "
+         "%lld evictions",
+         cache_policy_names[cache_policy], cache_capacity(),
+         s.hits, s.misses, s.evictions);
+  if(accesses > 0)
+    printf(", %lld.%lld%% hit ratio",
+           s.hits * 100 / accesses, s.hits * 1000 / accesses % 10);
+  printf("\n");
+  printf("Buffer cache: %lld coalesced misses, %lld write-backs, "
+         "read-ahead %lld issued, %lld used, %lld wasted\n",
+         s.coalesced, s.write_backs, s.ra_issued, s.ra_used, s.ra_wasted);
+  printf("Buffer cache lock: %lld acquires, %lld contended, %lld ms waited\n",
+         s.lock_acquires, s.lock_contended, s.lock_wait_ms);
+  printf("Buffer cache entries:");
+  for(int i = 0; i < CACHE_CLASS_CNT; i++)
+    printf("%s %zu %s", i == 0 ? "" : ",", cache_class_cnt[i],
+           cache_class_names[i]);
+  printf("\n");
 }
 
+/* Cache hit latency benchmark, run by the "cachebench" action.
+  For each working set size, it reads that many cache blocks from
+  the start of fs_device on demand, so that they are cached, and
+  then times reads over them until at least half a second has
+  passed. The reads go through cache_bench_read(), which leaves
+  the class of entries that already hold metadata alone. The hits
+  and misses reported are those of the timed reads only, and the
+  counters are put back as they were afterward, so that the
+  benchmark doesn't show up in them. Working sets larger than the
+  cache can't be measured as hits, so they are only reported; boot
+  with -cache=N to measure them.
+  */
 void
-read_ahead_acquire()
+cache_bench(char **argv UNUSED)
 {
-  lock_acquire(&read_ahead_lock);
+  static const int sizes[] = {64, 512, 4096};
+  static char buf[BLOCK_SECTOR_SIZE];
+  int capacity = cache_size;
+  struct cache_stats saved, stats;
+  int64_t saved_wait_ticks;
+
+  cache_acquire();
+  saved = cache_stats;
+  saved_wait_ticks = cache_lock_wait_ticks;
+  cache_release();
+
+  for(unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    int entries = sizes[i];
+    if(entries > capacity
+       || (block_sector_t)entries * cache_block_sectors > block_size(fs_device))
+    {
+      printf("cachebench: %4d entries: skipped (cache holds %d entries)\n",
+             entries, capacity);
+      continue;
+    }
+
+    for(int s = 0; s < entries; s++)
+      cache_bench_read(s * cache_block_sectors, buf);
+
+    cache_acquire();
+    memset(&cache_stats, 0, sizeof cache_stats);
+    cache_release();
+
+    long long reads = 0;
+    int64_t start = timer_ticks();
+    while(timer_elapsed(start) < TIMER_FREQ / 2)
+    {
+      for(int s = 0; s < entries; s++)
+        cache_bench_read(s * cache_block_sectors, buf);
+      reads += entries;
+    }
+    int64_t elapsed = timer_elapsed(start);
+
+    cache_acquire();
+    stats = cache_stats;
+    cache_release();
+    printf("cachebench: %4d entries: %lld hits, %lld misses, %lld ns/read\n",
+           entries, stats.hits, stats.misses,
+           elapsed * (1000000000 / TIMER_FREQ) / reads);
+  }
+
+  cache_acquire();
+  cache_stats = saved;
+  cache_lock_wait_ticks = saved_wait_ticks;
+  cache_release();
 }
 
-void
-read_ahead_release()
+/* Same as cache_read_from_buf(), for cache_bench(): the entry
+  keeps whatever class it had. */
+static void
+cache_bench_read(block_sector_t sector, void *buffer)
 {
-  lock_release(&read_ahead_lock);
-}
\ No newline at end of file
+  struct cache_e *cache_entry = cache_get(sector, CACHE_CLASS_CNT, false,
+                                          false);
+  memcpy(buffer, cache_sector_data(cache_entry, sector), BLOCK_SECTOR_SIZE);
+  cache_unpin(cache_entry);
+}
@@ -1,48 +1,112 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
 #include <list.h>
+#include <cache-stats.h>
 #include "devices/block.h"
 #include "threads/synch.h"
 
+/* Default number of sectors the buffer cache holds.
+   Can be changed with the -cache=N kernel option. */
+#define CACHE_SIZE 64
+
+/* Most sectors a cache entry can hold, one page's worth.
+   The -cache-block=N kernel option picks N sectors per entry. */
+#define CACHE_BLOCK_MAX 8
+
+/* Fewest entries the cache may have. Growing a file keeps up to
+   three entries pinned at once, through cache_pin(). */
+#define CACHE_MIN_ENTRIES 4
+
+/* Buffer cache replacement policies, chosen with the
+   -cache-policy kernel option. */
+enum cache_policy
+  {
+    CACHE_CLOCK,                  /* Second chance on a clock sweep. */
+    CACHE_LRU,                    /* Least recently used. */
+    CACHE_POLICY_CNT
+  };
+
+/* What a cache entry holds. Metadata, that is every class but
+   CACHE_DATA, is only evicted when no file data can be, or when it
+   takes up more than CACHE_META_PCT percent of the cache, so that
+   path lookups and block map walks stay cached under heavy file
+   I/O. */
+enum cache_class
+  {
+    CACHE_DATA,                   /* Regular file data. */
+    CACHE_INODE,                  /* On-disk inodes. */
+    CACHE_INDEX,                  /* Indirect blocks. */
+    CACHE_DIR,                    /* Directory contents. */
+    CACHE_FREE_MAP,               /* Free map contents. */
+    CACHE_CLASS_CNT
+  };
+#define CACHE_META_PCT 75
+
+/* State of the data in a cache entry. */
+enum cache_state
+  {
+    CACHE_LOADING,                /* Being read from disk. */
+    CACHE_VALID,                  /* Matches or is newer than disk. */
+    CACHE_WRITING                 /* Being written back to disk. */
+  };
+
 struct cache_e
   {
-    char buf[BLOCK_SECTOR_SIZE];
-    block_sector_t sector_idx;
+    char *buf;                    /* Data of the whole block. */
+    block_sector_t sector_idx;    /* First sector of the block. */
     
-    int slot_idx;
+    int slot_idx;                 /* Index into the slot array. */
+    bool in_use;                  /* False while on the free list. */
+    enum cache_state state;
+    enum cache_class class;       /* Set by the latest demand access. */
+    int pin_cnt;                  /* Holders; evictable only at 0. */
+    struct condition io_done;     /* Signaled when a read or write ends. */
     bool dirty;
-    int access_count;
-    struct list_elem elem;
+    int64_t dirty_tick;           /* When it last became dirty. */
+    struct list_elem dirty_elem;  /* cache_dirty_list, if dirty. */
+    bool accessed;                /* Reference bit for CACHE_CLOCK. */
+    bool read_ahead;              /* Read ahead, not yet accessed. */
+    struct list_elem elem;        /* cache_list, or free list if unused. */
+    struct list_elem bucket_elem; /* Bucket of the sector index. */
   };
 
-struct read_ahead_e
-{
-  block_sector_t sector_idx;
-  struct semaphore sector_sema;
-  struct list_elem elem;
-};
-
-void cache_init(void);
+void cache_init(size_t, size_t, enum cache_policy);
+enum cache_policy cache_policy_by_name(const char *);
+size_t cache_capacity(void);
+void cache_get_stats(struct cache_stats *);
+void cache_print_stats(void);
 struct cache_e *lookup_cache(block_sector_t);
-void cache_evict(void);
+bool cache_evict(void);
 struct cache_e *cache_create(block_sector_t);
-struct cache_e *cache_load(block_sector_t);
-struct cache_e *cache_load_ahead(block_sector_t);
-void cache_write_from_buf(block_sector_t, void*);
-void cache_read_from_buf(block_sector_t , void*);
+struct cache_e *cache_load(block_sector_t, enum cache_class);
+void *cache_sector_data(struct cache_e *, block_sector_t);
+void *cache_pin(block_sector_t, enum cache_class, struct cache_e **);
+void *cache_pin_new(block_sector_t, enum cache_class, struct cache_e **);
+void cache_zero(block_sector_t, enum cache_class);
+void cache_unpin(struct cache_e *);
+void cache_unpin_cold(struct cache_e *);
+bool cache_load_ahead(block_sector_t);
+void cache_write_from_buf(block_sector_t, enum cache_class, void*);
+void cache_write_through(block_sector_t, enum cache_class, void*);
+void cache_write_back(struct cache_e *);
+void cache_mark_dirty(struct cache_e *);
+void cache_read_from_buf(block_sector_t, enum cache_class, void*);
 
+void cache_flush_configure(int, int, size_t);
 void cache_flush(void);
 void cache_flush_thread_func(void* aux);
 
-void ra_list_flush(void);
+void cache_read_ahead(block_sector_t);
+void read_ahead_flush(void);
 void read_aheader_func(void *aux);
 
-int cache_find_empty_slot(void);
-void cache_slot_set(int, bool);
-
-struct read_ahead_e * lookup_ra_list(block_sector_t);
-struct read_ahead_e * rae_create(block_sector_t);
-
 void cache_acquire(void);
 void cache_release();
 
 void read_ahead_acquire();
-void read_ahead_release();
\ No newline at end of file
+void read_ahead_release();
+
+void cache_bench(char **argv);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,197 @@
+#include "filesys/dcache.h"
+#include <string.h>
+#include <stdio.h>
+#include <hash.h>
+#include <list.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Name cache: remembers what looking up a name in a directory
+  found, keyed by the directory's inode sector and the name, so
+  that resolving a path doesn't read the directories along it
+  again. A child of 0, the free map's inode, which no directory
+  entry names, records that the name isn't there.
+
+  Entries change only through dir_add() and dir_remove(), which
+  keep the cache up to date with dcache_set(), and when a removed
+  directory's entries are purged. Lookups add what they find with
+  dcache_fill(), which never replaces an entry, so a lookup that
+  raced with a change can't put back what the change replaced. */
+struct dentry
+  {
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up in it. */
+    block_sector_t child;               /* Its inode sector, or 0. */
+    bool in_use;                        /* Holds a name? */
+    struct list_elem bucket_elem;       /* Element in dcache_buckets. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+  };
+
+#define DCACHE_BUCKET_CNT 64
+
+/* Entries are allocated once, like the buffer cache's, and the
+  index has a fixed number of buckets. dcache_lru runs from the
+  least to the most recently used entry in use; unused entries
+  sit at its front. */
+static struct dentry dcache[DCACHE_SIZE];
+static struct list dcache_buckets[DCACHE_BUCKET_CNT];
+static struct list dcache_lru;
+static struct lock dcache_lock;
+
+/* Counters for dcache_print_stats(). */
+static long long dcache_hits;
+static long long dcache_negative_hits;
+static long long dcache_misses;
+
+static struct list *dcache_bucket(block_sector_t, const char *);
+static struct dentry *dcache_find(block_sector_t, const char *);
+static void dcache_put(block_sector_t, const char *, block_sector_t, bool);
+
+void
+dcache_init(void)
+{
+  lock_init(&dcache_lock);
+  list_init(&dcache_lru);
+  for(int i = 0; i < DCACHE_BUCKET_CNT; i++)
+    list_init(&dcache_buckets[i]);
+  for(int i = 0; i < DCACHE_SIZE; i++)
+  {
+    dcache[i].in_use = false;
+    list_push_back(&dcache_lru, &dcache[i].lru_elem);
+  }
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+  Returns false if the cache doesn't know. Otherwise returns true
+  and sets *CHILD to the sector of the inode NAME refers to, or to
+  0 if the directory has no such name. */
+bool
+dcache_lookup(block_sector_t parent, const char *name, block_sector_t *child)
+{
+  struct dentry *d;
+
+  lock_acquire(&dcache_lock);
+  d = dcache_find(parent, name);
+  if(d != NULL)
+  {
+    *child = d->child;
+    list_remove(&d->lru_elem);
+    list_push_back(&dcache_lru, &d->lru_elem);
+    if(d->child != 0)
+      dcache_hits++;
+    else
+      dcache_negative_hits++;
+  }
+  else
+    dcache_misses++;
+  lock_release(&dcache_lock);
+  return d != NULL;
+}
+
+/* Records what a lookup of NAME in directory PARENT found: the
+  sector CHILD, or 0 for nothing. Leaves any entry the cache
+  already has alone. */
+void
+dcache_fill(block_sector_t parent, const char *name, block_sector_t child)
+{
+  dcache_put(parent, name, child, false);
+}
+
+/* Records that NAME in directory PARENT now refers to sector
+  CHILD, or to nothing if CHILD is 0, for dir_add() and
+  dir_remove(). */
+void
+dcache_set(block_sector_t parent, const char *name, block_sector_t child)
+{
+  dcache_put(parent, name, child, true);
+}
+
+/* Forgets every name in directory PARENT, which is being removed,
+  so that nothing stale is found if its sector is reused. */
+void
+dcache_purge(block_sector_t parent)
+{
+  lock_acquire(&dcache_lock);
+  for(int i = 0; i < DCACHE_SIZE; i++)
+  {
+    struct dentry *d = &dcache[i];
+    if(d->in_use && d->parent == parent)
+    {
+      d->in_use = false;
+      list_remove(&d->bucket_elem);
+      list_remove(&d->lru_elem);
+      list_push_front(&dcache_lru, &d->lru_elem);
+    }
+  }
+  lock_release(&dcache_lock);
+}
+
+void
+dcache_print_stats(void)
+{
+  long long lookups = dcache_hits + dcache_negative_hits + dcache_misses;
+
+  printf("Name cache: %lld hits, %lld negative hits, %lld misses",
+         dcache_hits, dcache_negative_hits, dcache_misses);
+  if(lookups > 0)
+    printf(" (%lld%% hit)",
+           (dcache_hits + dcache_negative_hits) * 100 / lookups);
+  printf("\n");
+}
+
+/* Does the work of dcache_fill() and dcache_set(). REPLACE tells
+  whether an existing entry for the name is overwritten. The least
+  recently used entry makes room for a new one. */
+static void
+dcache_put(block_sector_t parent, const char *name, block_sector_t child,
+           bool replace)
+{
+  struct dentry *d;
+
+  /* Such a name can't be in any directory. */
+  if(strlen(name) > NAME_MAX)
+    return;
+
+  lock_acquire(&dcache_lock);
+  d = dcache_find(parent, name);
+  if(d == NULL)
+  {
+    d = list_entry(list_front(&dcache_lru), struct dentry, lru_elem);
+    if(d->in_use)
+      list_remove(&d->bucket_elem);
+    d->in_use = true;
+    d->parent = parent;
+    strlcpy(d->name, name, sizeof d->name);
+    d->child = child;
+    list_push_back(dcache_bucket(parent, name), &d->bucket_elem);
+  }
+  else if(replace)
+    d->child = child;
+  list_remove(&d->lru_elem);
+  list_push_back(&dcache_lru, &d->lru_elem);
+  lock_release(&dcache_lock);
+}
+
+static struct list *
+dcache_bucket(block_sector_t parent, const char *name)
+{
+  unsigned h = hash_int(parent) ^ hash_string(name);
+  return &dcache_buckets[h % DCACHE_BUCKET_CNT];
+}
+
+/* Returns the entry for NAME in directory PARENT, or a null
+  pointer. Must be called with dcache_lock held. */
+static struct dentry *
+dcache_find(block_sector_t parent, const char *name)
+{
+  struct list *bucket = dcache_bucket(parent, name);
+  struct list_elem *e;
+
+  for(e = list_begin(bucket); e != list_end(bucket); e = list_next(e))
+  {
+    struct dentry *d = list_entry(e, struct dentry, bucket_elem);
+    if(d->parent == parent && !strcmp(d->name, name))
+      return d;
+  }
+  return NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of names the name cache remembers. */
+#define DCACHE_SIZE 256
+
+void dcache_init(void);
+bool dcache_lookup(block_sector_t, const char *, block_sector_t *);
+void dcache_fill(block_sector_t, const char *, block_sector_t);
+void dcache_set(block_sector_t, const char *, block_sector_t);
+void dcache_purge(block_sector_t);
+void dcache_print_stats(void);
+
+#endif /* filesys/dcache.h */
@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/dcache.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
@@ -22,6 +25,32 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Directories come in two formats.  By default, entries are packed
+   one after another, and finding a name reads the directory from
+   the start.
+
+   In the hashed format, chosen with the -hashdirs kernel option
+   when the directory is created, the directory is a table of
+   DIR_BUCKET_CNT buckets of one sector each.  An entry goes into
+   the first bucket with a free slot, probing on from the bucket its
+   name hashes to, so that finding or adding a name normally reads
+   a single sector.  A removed entry keeps its name, which marks
+   that the bucket once filled up; a search stops at the first
+   bucket that has a slot never used.  Buckets that never held an
+   entry are holes in the directory's file, which take no space.
+   Entries never move, so readdir order is stable. */
+#define DIR_BUCKET_CNT 256
+#define BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+  };
+
+static bool hash_probe (const struct dir *, const char *name,
+                        struct dir_entry *, off_t *ofsp, off_t *freep);
+static off_t next_entry (const struct dir *, off_t pos);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -99,6 +128,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (inode_is_hashed (dir->inode))
+    return hash_probe (dir, name, ep, ofsp, NULL);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -112,24 +144,99 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Searches hashed directory DIR for NAME, probing the buckets from
+   the one NAME hashes to.  If NAME is found, returns true and sets
+   *EP to its entry if EP is non-null and *OFSP to the entry's byte
+   offset if OFSP is non-null.  Otherwise returns false and, if
+   FREEP is non-null, sets *FREEP to the offset of the first free
+   slot on the way, or -1 if there is none. */
+static bool
+hash_probe (const struct dir *dir, const char *name,
+            struct dir_entry *ep, off_t *ofsp, off_t *freep)
+{
+  struct dir_bucket *bucket = malloc (sizeof *bucket);
+  unsigned home = hash_string (name) % DIR_BUCKET_CNT;
+  bool found = false;
+  bool end = false;
+  size_t i, j;
+
+  if (freep != NULL)
+    *freep = -1;
+  if (bucket == NULL)
+    return false;
+
+  for (i = 0; i < DIR_BUCKET_CNT && !found && !end; i++)
+    {
+      off_t base = (home + i) % DIR_BUCKET_CNT * BLOCK_SECTOR_SIZE;
+
+      /* A bucket past the end of the file reads as empty. */
+      memset (bucket, 0, sizeof *bucket);
+      inode_read_at (dir->inode, bucket, sizeof *bucket, base);
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        {
+          struct dir_entry *e = &bucket->entries[j];
+          off_t ofs = base + j * sizeof *e;
+
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              found = true;
+              break;
+            }
+          if (!e->in_use)
+            {
+              if (freep != NULL && *freep == -1)
+                *freep = ofs;
+              if (e->name[0] == '\0')
+                end = true;
+            }
+        }
+    }
+  free (bucket);
+  return found;
+}
+
+/* Returns the byte offset of the entry that follows the one at POS
+   in DIR.  Entries of a hashed directory don't cross sectors, so
+   the bytes left over at the end of each bucket are skipped. */
+static off_t
+next_entry (const struct dir *dir, off_t pos)
+{
+  pos += sizeof (struct dir_entry);
+  if (inode_is_hashed (dir->inode)
+      && (size_t) (pos % BLOCK_SECTOR_SIZE)
+         > BLOCK_SECTOR_SIZE - sizeof (struct dir_entry))
+    pos = ROUND_UP (pos, BLOCK_SECTOR_SIZE);
+  return pos;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names found, or found missing, before are answered from the
+   name cache without reading DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t parent;
+  block_sector_t sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL)){
-    *inode = inode_open (e.inode_sector);
-  }
-  else
-    *inode = NULL;
+  parent = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (parent, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dcache_fill (parent, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
 
   return *inode != NULL;
 }
@@ -154,28 +261,43 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL)){
-    goto done;
-  }
-
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  if (inode_is_hashed (dir->inode))
+    {
+      /* Check that NAME is not in use, finding a free slot on the
+         way.  Fails if the table is full. */
+      if (hash_probe (dir, name, NULL, NULL, &ofs) || ofs == -1)
+        goto done;
+      memset (&e, 0, sizeof e);
+    }
+  else
+    {
+      /* Check that NAME is not in use. */
+      if (lookup (dir, name, NULL, NULL)){
+        goto done;
+      }
+
+      /* Set OFS to offset of free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
+
+         inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get a
+         short read due to something intermittent such as low
+         memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e) 
+        if (!e.in_use)
+          break;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_set (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
   return success;
@@ -208,9 +330,12 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_set (inode_get_inumber (dir->inode), name, 0);
 
-  /* Remove inode. */
+  /* Remove inode, and forget any names cached under it, in case
+     its sector is reused for a directory. */
   inode_remove (inode);
+  dcache_purge (e.inode_sector);
   success = true;
 
  done:
@@ -228,7 +353,7 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
-      dir->pos += sizeof e;
+      dir->pos = next_entry (dir, dir->pos);
       if (e.in_use && check_dir_entry(e.name))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
@@ -254,7 +379,7 @@ dir_print (struct dir *dir)
 
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
-      dir->pos += sizeof e;
+      dir->pos = next_entry (dir, dir->pos);
       if (e.in_use)
         {
           printf("%s ", e.name);
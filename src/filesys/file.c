@@ -1,16 +1,31 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window for sequential readers, in sectors. It
+   starts at READ_AHEAD_MIN and doubles on every sequential read
+   up to READ_AHEAD_MAX, or a quarter of the buffer cache if that
+   is less, so read-ahead can't take over the whole cache. */
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 64
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_start;             /* Where the sequential run started. */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of the range queued for read-ahead. */
+    size_t ra_window;           /* Read-ahead window, 0 if not sequential. */
   };
 
+static void file_read_ahead (struct file *, off_t start, off_t size);
+static bool file_streaming (const struct file *);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +38,10 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_start = 0;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -68,11 +87,78 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t start = file->pos;
+  off_t bytes_read;
+
+  if (file_streaming (file))
+    bytes_read = inode_read_stream (file->inode, buffer, size, file->pos);
+  else
+    bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file_read_ahead (file, start, bytes_read);
   return bytes_read;
 }
 
+/* Returns true if FILE is being streamed: the next read continues
+   a sequential run longer than half the buffer cache.  Such a run
+   would flush the whole cache, so its sectors are read with
+   inode_read_stream() instead, which keeps them from pushing out
+   the directory and inode sectors everyone else depends on. */
+static bool
+file_streaming (const struct file *file)
+{
+  off_t run = file->ra_next - file->ra_start;
+
+  return (file->pos == file->ra_next && file->ra_window != 0
+          && run >= (off_t) (cache_capacity () * BLOCK_SECTOR_SIZE / 2));
+}
+
+/* Updates FILE's read-ahead state after a read of SIZE bytes at
+   START, and queues the next window of the file if it is being
+   read sequentially, that is, if this read started where the
+   previous one ended.  Each sequential read doubles the window;
+   any other read turns read-ahead off until the reader is
+   sequential again.  Only sectors not queued yet are requested,
+   so read-ahead stays one window in front of the reader. */
+static void
+file_read_ahead (struct file *file, off_t start, off_t size)
+{
+  size_t window_max = cache_capacity () / 4;
+  off_t from, to;
+
+  if (size == 0)
+    return;
+
+  if (window_max > READ_AHEAD_MAX)
+    window_max = READ_AHEAD_MAX;
+  if (window_max < READ_AHEAD_MIN)
+    window_max = READ_AHEAD_MIN;
+
+  if (start != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+      file->ra_start = start;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < window_max)
+    file->ra_window *= 2;
+  if (file->ra_window > window_max)
+    file->ra_window = window_max;
+  file->ra_next = start + size;
+
+  if (file->ra_window == 0)
+    return;
+  from = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  to = file->ra_next + (off_t) file->ra_window * BLOCK_SECTOR_SIZE;
+  if (to > from)
+    {
+      inode_read_ahead (file->inode, from, to - from);
+      file->ra_end = to;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
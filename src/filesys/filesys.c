@@ -7,7 +7,10 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "threads/thread.h"
+#include "threads/malloc.h"
+#include "devices/timer.h"
 
 struct dir 
   {
@@ -30,12 +33,16 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+
+  printf ("Buffer cache: %zu sectors (%zu kB).\n",
+          cache_capacity (), cache_capacity () * BLOCK_SECTOR_SIZE / 1024);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -44,7 +51,7 @@ void
 filesys_done (void) 
 {
   cache_flush();
-  ra_list_flush();
+  read_ahead_flush();
   free_map_close ();
 }
 
@@ -55,22 +62,19 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size, bool is_dir) 
 {
-  //create-long testcase
-  if(strlen(name) > 128)
-    return false;
-  
   block_sector_t inode_sector = 0;
   /* if this is directory creation, parse the name and get
     the starting directory
   */
-  char* target = (char *)malloc(sizeof(name));
-  file_from_path(name, target);
-  struct dir * dir = almost_reach_path(name);
+  char target[NAME_MAX + 1];
+  struct dir * dir = path_walk(name, target);
+
+  if(dir == NULL)
+    return false;
 
   bool affordable = free_map_allocate(1, &inode_sector);
 
   if(!affordable) {
-    free(target);
     dir_close (dir);
     return false;
   }
@@ -93,7 +97,6 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
     dir_add(new_dir, ".", inode_sector);
     dir_close(new_dir);
   }
-  free(target);
   dir_close (dir);
 
   return success;
@@ -107,9 +110,8 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
 struct file *
 filesys_open (const char *name)
 {
-  char* target = (char *)malloc(sizeof(name));
-  file_from_path(name, target);
-  struct dir* dir = almost_reach_path(name);
+  char target[NAME_MAX + 1];
+  struct dir* dir = path_walk(name, target);
 
   struct inode *inode = NULL;
 
@@ -117,7 +119,6 @@ filesys_open (const char *name)
     dir_lookup (dir, target, &inode);
   }
   dir_close (dir);
-  free(target);
 
   return file_open (inode);
 }
@@ -131,9 +132,8 @@ filesys_remove (const char *name)
 {
   if(name_is_root(name)) return false;
 
-  char* target = (char *)malloc(sizeof(name));
-  file_from_path(name, target);
-  struct dir* dir = almost_reach_path(name);
+  char target[NAME_MAX + 1];
+  struct dir* dir = path_walk(name, target);
   char entry[NAME_MAX + 1];
 
   /* Check whether it is directory or not */
@@ -145,23 +145,23 @@ filesys_remove (const char *name)
   bool removable = true;
   bool check = false;
 
-  if(inode_dir(inode)){
+  if(inode != NULL && inode_dir(inode)){
     struct dir* new_dir = dir_open(inode);
     if(inode_dir_opened(inode)
       || inode_dir_cwd(inode)
       || (check = dir_readdir(new_dir, entry))) removable = false;
     dir_close(new_dir);
   }
+  else
+    inode_close(inode);
   
   if(!removable){
     dir_close(dir);
-    free(target);
     return false;
   }
 
   bool success = dir != NULL && dir_remove (dir, target);
   dir_close (dir); 
-  free(target);
 
   return success;
 }
@@ -186,155 +186,193 @@ do_format (void)
   printf ("done.\n");
 }
 
-/* Obtain the last file or directory from path */
-void
-file_from_path(const char* name, char* dest)
+/* Extracts a file name part from *SRCP into PART, and updates *SRCP
+   so that the next call will return the next file name part.
+   Returns 1 if successful, 0 at end of string, -1 for a too-long
+   file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
 {
-  char chunk1[128];
-  memcpy(chunk1, name, strlen(name));
-  chunk1[strlen(name)] = '\0';
-
-  if(name_is_root(name)){
-    *dest = '.'; *(dest+1) = '\0';
-    return;
-  }
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
 
-  char *token, *save_ptr;
-  for(token = strtok_r(chunk1, "/", &save_ptr) ; token!=NULL ;
-    token = strtok_r(NULL, "/", &save_ptr))
-  {
-    memcpy(dest, token, strlen(token));
-    *(dest+strlen(token)) = '\0';
-  }
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
 }
 
-/* This calculates the number of directoris right before the last one */
-int
-dirs_in_path(const char* name)
+/* Walks path NAME in a single pass, without copying it, and
+   returns the directory that holds its last component, which is
+   stored in LAST.  NAME is relative to the current directory
+   unless it starts with '/'.  A path of slashes only names the
+   root directory itself, as "." in the root.
+   Returns a null pointer if a directory along the way doesn't
+   exist or isn't a directory, or if a component is longer than
+   NAME_MAX.  Otherwise the caller must close the directory. */
+struct dir *
+path_walk (const char *name, char last[NAME_MAX + 1])
 {
-  char chunk1[128];
-  memcpy(chunk1, name, strlen(name));
-  chunk1[strlen(name)] = '\0';
-
-  int cnt=0;
-  char *token, *save_ptr;
-  for(token = strtok_r(chunk1, "/", &save_ptr) ; token!=NULL ;
-    token = strtok_r(NULL, "/", &save_ptr))
-  {
-    cnt++;
-  }
-  return cnt;
-}
-
-/* this return the struct dir* to the directory
-  right before the last one. If directory doesn't exist,
-  return NULL
-  */
-struct dir*
-almost_reach_path(const char* name)
-{
-  if(strlen(name) == 0) return NULL;
-
-  //char* target = (char *)malloc(sizeof(name));
-  //file_from_path(name, target);
-
-  int nums = dirs_in_path(name);
-
-  struct dir* dir = NULL;
-  char chunk[128];
-  memcpy(chunk, name, strlen(name));
-  chunk[strlen(name)] = '\0';
-  if(name[0] == '/')
-  { /* This is absolute path */
-    dir = dir_open_root();
-  }
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  int got;
+
+  if (*name == '\0')
+    return NULL;
+  if (*name == '/' || thread_current ()->cwd == NULL)
+    dir = dir_open_root ();
   else
-  {
-    if(thread_current()->cwd == NULL)
+    dir = dir_reopen (thread_current ()->cwd);
+  if (dir == NULL)
+    return NULL;
+
+  got = get_next_part (last, &name);
+  if (got == 0)
     {
-      dir = dir_open_root();
+      strlcpy (last, ".", NAME_MAX + 1);
+      return dir;
     }
-    else
+  while (got > 0)
     {
-      dir = dir_reopen(thread_current()->cwd);
-    }
-  }
-
-  char *token, *save_ptr;
-  int cnt = 0;
-  for(token = strtok_r(chunk, "/", &save_ptr) ; token!=NULL ;
-      token = strtok_r(NULL, "/", &save_ptr))
-  {
-    if(cnt+1 >= nums) break;
-    struct inode* inode = NULL;
-    if(dir_lookup(dir, token, &inode)){
-      dir_close(dir);
-      dir = dir_open(inode);
+      struct inode *inode;
+
+      got = get_next_part (part, &name);
+      if (got == 0)
+        return dir;
+      if (got < 0)
+        break;
+
+      /* LAST wasn't the last component: step into it. */
+      if (!dir_lookup (dir, last, &inode))
+        break;
+      if (!inode_dir (inode))
+        {
+          inode_close (inode);
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return NULL;
+      strlcpy (last, part, NAME_MAX + 1);
     }
-    else break;
-    cnt++;
-  }
-  //free(target);
-
-  /* The number of upper directories must be less 1 than the whole path */
-  //printf("target file : %s\n", target);
-  if(token == NULL) return dir; //This is root directory
-  if(cnt+1 != nums) dir = NULL;
-  //printf("%p\n", dir);
-
-  return dir;
+  dir_close (dir);
+  return NULL;
 }
 
+/* Opens the directory that path NAME names.  Returns a null
+   pointer if there is none, or if NAME names a file. */
 struct dir*
 reach_path(const char* name)
 {
-  if(strlen(name) == 0) return NULL;
-
-  int nums = dirs_in_path(name);
+  char last[NAME_MAX + 1];
+  struct dir *dir = path_walk (name, last);
+  struct inode *inode = NULL;
 
-  struct dir* dir = NULL;
-  char chunk[128];
-  memcpy(chunk, name, strlen(name));
-  chunk[strlen(name)] = '\0';
-  if(name[0] == '/')
-  { /* This is absolute path */
-    dir = dir_open_root();
-  }
-  else
-  {
-    if(thread_current()->cwd == NULL)
-    {
-      dir = dir_open_root();
-    }
-    else
+  if (dir != NULL)
+    dir_lookup (dir, last, &inode);
+  dir_close (dir);
+  if (inode == NULL)
+    return NULL;
+  if (!inode_dir (inode))
     {
-      dir = dir_reopen(thread_current()->cwd);
-    }
-  }
-
-  char *token, *save_ptr;
-  int cnt = 0;
-  for(token = strtok_r(chunk, "/", &save_ptr) ; token!=NULL ;
-      token = strtok_r(NULL, "/", &save_ptr))
-  {
-    struct inode* inode = NULL;
-    if(dir_lookup(dir, token, &inode)){
-      dir_close(dir);
-      dir = dir_open(inode);
+      inode_close (inode);
+      return NULL;
     }
-    else {
-      break;
-    }
-    cnt++;
-  }
-
-  /* The number of directories or files must be equal the whole path */
-  if(cnt != nums) dir = NULL;
-  return dir;
+  return dir_open (inode);
 }
 
 bool
 name_is_root(const char *name)
 {
   return (*name == '/' && *(name+1) == '\0') ;
-}
\ No newline at end of file
+}
+
+/* Path resolution benchmark, run by the "pathbench" kernel action.
+   Builds a chain of PATH_BENCH_DEPTH nested directories from the
+   root, with a file in each, and prints how long opening the file
+   at each depth by its full path takes.  The deepest paths are
+   longer than 128 bytes.  Everything is removed afterward. */
+#define PATH_BENCH_DEPTH 40
+
+void
+filesys_path_bench (char **argv UNUSED)
+{
+  /* PATH holds "/dir" once per directory, then "/f". */
+  char *path = malloc (PATH_BENCH_DEPTH * 4 + 3);
+  size_t len = 0;
+  int made = 0;
+  int depth;
+
+  if (path == NULL)
+    {
+      printf ("pathbench: out of memory\n");
+      return;
+    }
+
+  for (depth = 0; ; depth++)
+    {
+      long long opens = 0;
+      int64_t start, elapsed;
+
+      strlcpy (path + len, "/f", 3);
+      if (!filesys_create (path, 0, false))
+        {
+          printf ("pathbench: creating %s failed\n", path);
+          break;
+        }
+
+      start = timer_ticks ();
+      while (timer_elapsed (start) < TIMER_FREQ / 10)
+        {
+          file_close (filesys_open (path));
+          opens++;
+        }
+      elapsed = timer_elapsed (start);
+      printf ("pathbench: depth %2d, %3zu bytes: %lld ns/open\n",
+              depth, strlen (path),
+              elapsed * (1000000000 / TIMER_FREQ) / opens);
+
+      if (depth == PATH_BENCH_DEPTH)
+        break;
+      strlcpy (path + len, "/dir", 5);
+      if (!filesys_create (path, 0, true))
+        {
+          printf ("pathbench: creating %s failed\n", path);
+          break;
+        }
+      len += 4;
+      made++;
+    }
+
+  /* Remove the files and directories, deepest first. */
+  for (;;)
+    {
+      strlcpy (path + len, "/f", 3);
+      filesys_remove (path);
+      if (made == 0)
+        break;
+      path[len] = '\0';
+      filesys_remove (path);
+      len -= 4;
+      made--;
+    }
+  free (path);
+}
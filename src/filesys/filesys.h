@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
+#include "filesys/directory.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
@@ -17,9 +18,8 @@ bool filesys_create (const char *name, off_t initial_size, bool is_dir);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
 
-void file_from_path(const char *name, char* dest);
-int dirs_in_path(const char* name);
-struct dir* almost_reach_path(const char* name);
+struct dir *path_walk (const char *name, char last[NAME_MAX + 1]);
 struct dir* reach_path(const char* name);
 bool name_is_root(const char *name);
+void filesys_path_bench (char **argv);
 #endif /* filesys/filesys.h */
@@ -1,6 +1,9 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "devices/timer.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -8,6 +11,27 @@
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Nesting depth of free_map_batch_begin() calls, and whether the
+   free map changed since the outermost one.  While a batch is
+   open, changes are written to the free map file only once, when
+   it closes, instead of after every allocation and release. */
+static int batch_depth;
+static bool batch_dirty;
+
+/* Next-fit cursor: the sector just past the last allocation, where
+   free_map_allocate() starts looking for the next one, so that it
+   does not rescan the full start of a filling disk every time. */
+static block_sector_t free_map_hint;
+
+/* Sector the original allocator refused to hand out as a single
+   sector.  It is kept marked in use instead, so that scans skip it
+   rather than find it and then fail with its bit already flipped. */
+#define FREE_MAP_RESERVED 4095
+
+static bool free_map_persist (void);
+static void free_map_reserve (void);
+static long long bench_alloc (bool next_fit);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,37 +41,126 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_reserve ();
+}
+
+/* Marks FREE_MAP_RESERVED in use, if the device has such a
+   sector. */
+static void
+free_map_reserve (void)
+{
+  if (FREE_MAP_RESERVED < bitmap_size (free_map))
+    bitmap_mark (free_map, FREE_MAP_RESERVED);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
-   written. */
+   written.
+   The search starts where the previous allocation ended and wraps
+   around to the start of the disk (next fit). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if(cnt == 1 && sector == 4095) sector = BITMAP_ERROR;
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (free_map_hint, cnt, sectorp);
+}
+
+/* Same as free_map_allocate(), but takes the first run of CNT free
+   sectors at or after GOAL, wrapping around to the start of the
+   disk if there is none, so that callers can keep related sectors
+   close together. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+
+  if (goal < bitmap_size (free_map))
+    sector = bitmap_scan_and_flip (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal != 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR && !free_map_persist ())
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      *sectorp = sector;
+      free_map_hint = sector + cnt;
+    }
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the free sectors that start at SECTOR, up to CNT of
+   them, and returns how many it allocated: 0 if SECTOR itself is
+   in use or past the end of the device. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  size_t run = 0;
+
+  while (run < cnt && sector + run < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + run))
+    run++;
+  if (run == 0)
+    return 0;
+
+  bitmap_set_multiple (free_map, sector, run, true);
+  if (!free_map_persist ())
+    {
+      bitmap_set_multiple (free_map, sector, run, false);
+      return 0;
+    }
+  return run;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_persist ();
+}
+
+/* Opens a batch of free map changes, which are written to disk
+   together by the matching free_map_batch_end().  Batches nest. */
+void
+free_map_batch_begin (void)
+{
+  batch_depth++;
+}
+
+/* Closes a batch opened by free_map_batch_begin(), writing the free
+   map if this was the outermost batch and it changed. */
+void
+free_map_batch_end (void)
+{
+  ASSERT (batch_depth > 0);
+  if (--batch_depth == 0 && batch_dirty)
+    {
+      batch_dirty = false;
+      if (free_map_file != NULL)
+        bitmap_write (free_map, free_map_file);
+    }
+}
+
+/* Writes the free map to its file after a change, unless a batch
+   is open, in which case the write is left to the end of the
+   batch.  Returns false if the write fails. */
+static bool
+free_map_persist (void)
+{
+  if (free_map_file == NULL)
+    return true;
+  if (batch_depth > 0)
+    {
+      batch_dirty = true;
+      return true;
+    }
+  return bitmap_write (free_map, free_map_file);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,8 +170,10 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_write_through (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_map_reserve ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -81,6 +196,75 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_write_through (file_get_inode (free_map_file));
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Allocation latency benchmark, run by the "allocbench" kernel
+   action.  Fills the free sectors a tenth at a time and, at each
+   step, times single-sector allocations that scan from sector 0
+   (first fit) and from the roving cursor (next fit).  Everything
+   is released again at the end, so the free map is left as it
+   was. */
+void
+free_map_bench (char **argv UNUSED)
+{
+  size_t size = bitmap_size (free_map);
+  size_t free_cnt = bitmap_count (free_map, 0, size, false);
+  block_sector_t *filled = malloc (free_cnt * sizeof *filled);
+  size_t filled_cnt = 0;
+  int step;
+
+  if (filled == NULL)
+    {
+      printf ("allocbench: out of memory\n");
+      return;
+    }
+
+  printf ("allocbench: %zu sectors, %zu free\n", size, free_cnt);
+  free_map_batch_begin ();
+  for (step = 0; step < 10; step++)
+    {
+      size_t target = free_cnt * step / 10;
+      block_sector_t sector;
+      long long first, next;
+
+      while (filled_cnt < target
+             && free_map_allocate_near (0, 1, &sector))
+        filled[filled_cnt++] = sector;
+
+      first = bench_alloc (false);
+      next = bench_alloc (true);
+      printf ("allocbench: %3zu%% full: first fit %6lld ns/alloc, "
+              "next fit %6lld ns/alloc\n",
+              bitmap_count (free_map, 0, size, true) * 100 / size,
+              first, next);
+    }
+  while (filled_cnt > 0)
+    free_map_release (filled[--filled_cnt], 1);
+  free_map_batch_end ();
+  free (filled);
+}
+
+/* Returns the average time, in nanoseconds, to allocate and
+   release one sector in the free map as it stands, scanning from
+   the next-fit cursor if NEXT_FIT, otherwise from sector 0. */
+static long long
+bench_alloc (bool next_fit)
+{
+  long long cnt = 0;
+  int64_t start = timer_ticks ();
+
+  while (timer_elapsed (start) < TIMER_FREQ / 10)
+    {
+      block_sector_t sector;
+      bool success = (next_fit
+                      ? free_map_allocate (1, &sector)
+                      : free_map_allocate_near (0, 1, &sector));
+      if (success)
+        free_map_release (sector, 1);
+      cnt++;
+    }
+  return timer_elapsed (start) * (1000000000 / TIMER_FREQ) / cnt;
+}
@@ -16,22 +16,51 @@
 
 struct lock inode_lock;
 
+/* A run of LENGTH contiguous sectors on disk, starting at START,
+   that holds a file's sectors from index IDX on.  An inode in the
+   extent format keeps up to EXTENT_CNT of them, in the space the
+   block pointer format uses for its direct blocks. */
+struct extent
+  {
+    block_sector_t idx;                 /* First sector index in file. */
+    block_sector_t start;               /* First sector on disk. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
+#define EXTENT_CNT 32
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Files use one of two formats for their block map.  By default,
+   DIRECT, INDIRECT and DOUBLE_INDIRECT point to single sectors.
+   In the extent format, chosen with the -extents kernel option
+   when the file is created, EXTENTS lists runs of contiguous
+   sectors instead.
+
+   IS_HASHED marks a directory in the hashed format (see
+   directory.c), chosen with the -hashdirs kernel option. */
 struct inode_disk
   {
-    block_sector_t direct[DIRECT];
+    union
+      {
+        block_sector_t direct[DIRECT];
+        struct extent extents[EXTENT_CNT]; /* If IS_EXTENT. */
+      };
     block_sector_t indirect;
     block_sector_t double_indirect;
 
     bool is_dir;
+    bool is_extent;                     /* Extent format? */
+    bool is_hashed;                     /* Hashed directory format? */
     int is_opened;
     int is_cwd;
 
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
+    int extent_cnt;                     /* Extents in use. */
 
-    char unused[100];
+    char unused[96];
   };
 
 struct indirect_disk
@@ -56,41 +85,92 @@ struct inode
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    bool write_through;                 /* Write data straight to disk? */
+    struct block_map *map;              /* Block map copies, or null. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
+    bool loading;                       /* DATA still being read? */
+    struct condition loaded;            /* Signaled when it has been. */
+  };
+
+/* Copies of the indirect blocks index_to_sector() read last for
+   an inode: the doubly indirect block, and the last single
+   indirect block, which may be INDIRECT or one the doubly
+   indirect block points to.  Sequential lookups past the direct
+   blocks then read a copy under LOCK instead of pinning sectors
+   in the buffer cache.  Allocated on first use; dropped whenever
+   the file grows.  A sector of 0, the free map's inode, marks an
+   empty slot. */
+enum block_map_slot
+  {
+    MAP_DOUBLE,                         /* The doubly indirect block. */
+    MAP_LEAF,                           /* A single indirect block. */
+    MAP_SLOT_CNT
+  };
+
+struct block_map
+  {
+    struct lock lock;                   /* Protects the rest. */
+    block_sector_t sector[MAP_SLOT_CNT]; /* Sector copied in each slot. */
+    struct indirect_disk block[MAP_SLOT_CNT]; /* The copies. */
   };
 
   
 /* Functions for indexed allocation */
-bool inode_alloc(struct inode_disk*, size_t, int);
-size_t indirect_alloc(struct indirect_disk*, size_t, int);
-bool sector_alloc(struct inode *, size_t);
+/* Sectors reserved by one inode_alloc() call, handed out in order
+  by sector_run_take() so that a file's blocks end up contiguous,
+  index blocks included. */
+struct sector_run
+  {
+    block_sector_t next;                /* Next reserved sector. */
+    size_t left;                        /* Reserved, not handed out. */
+    size_t want;                        /* Still to hand out in all. */
+    bool zero;                          /* Zero the data sectors? */
+    bool full;                          /* Did the disk run out? */
+  };
+
+bool inode_alloc(struct inode_disk*, size_t, int, block_sector_t, bool);
+size_t indirect_alloc(struct indirect_disk*, size_t, int,
+                      struct sector_run *);
+static bool inode_alloc_blocks(struct inode_disk*, size_t, int,
+                               struct sector_run *);
+static size_t index_sectors(size_t, size_t);
+static bool sector_run_take(struct sector_run *, block_sector_t *);
+bool sector_alloc(struct inode *, size_t, size_t, size_t, size_t);
+static block_sector_t indirect_lookup(block_sector_t, size_t);
+static size_t indirect_fill(block_sector_t, bool, size_t, int,
+                            struct sector_run *);
+static off_t inode_read (struct inode *, void *, off_t, off_t, bool);
+static enum cache_class inode_class (const struct inode *);
+static bool extent_alloc (struct inode_disk *, block_sector_t, size_t,
+                          block_sector_t, bool);
+static block_sector_t extent_lookup (const struct inode_disk *,
+                                     block_sector_t);
+static void extent_release (const struct inode_disk *);
+static void block_release (const struct inode_disk *);
+static void indirect_release (block_sector_t);
+static block_sector_t block_map_lookup (struct inode *, enum block_map_slot,
+                                        block_sector_t, size_t);
+static void block_map_invalidate (struct inode *);
+static void inode_persist (struct inode *);
+
+/* Whether inode_create() uses the extent format. */
+static bool use_extents;
+
+/* Whether inode_create() gives directories the hashed format. */
+static bool use_hashed_dirs;
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if that byte lies in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos, bool writing) 
+byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
     return index_to_sector(inode, byte_to_index(pos));
   else
-  {
-    if(writing)
-    {
-      size_t sectors = bytes_to_sectors(pos)
-                      - bytes_to_sectors(inode->data.length);
-      if(sector_alloc(inode, sectors))
-      {
-        return index_to_sector(inode, byte_to_index(pos));
-      }
-    }
-    else
-    {
-      return -1;
-    }
-  }
-  return -1;
+    return -1;
 }
 
 block_sector_t
@@ -99,33 +179,40 @@ byte_to_index(off_t bytes)
   return bytes / BLOCK_SECTOR_SIZE;
 }
 
+/* Returns the disk sector that holds sector IDX of INODE's data.
+  Files may have holes, sectors that were never written, which
+  read back as zeros: for those, and for sectors under an index
+  block that doesn't exist yet, returns 0. Sector 0 holds the free
+  map's inode, so it is never file data. */
 block_sector_t
 index_to_sector(struct inode *inode, block_sector_t idx)
 {
   block_sector_t sector;
 
-  if(idx < DIRECT)
+  if(inode->data.is_extent)
+  {
+    sector = extent_lookup(&inode->data, idx);
+  }
+  else if(idx < DIRECT)
   {
     sector = inode->data.direct[idx];
   } 
   else if(idx<DIRECT + INDIRECT)
   {
-    struct indirect_disk *indirect_first = (struct indirect_disk *)malloc(sizeof(struct indirect_disk));
-    cache_read_from_buf(inode->data.indirect, indirect_first);
-    sector = indirect_first->data[idx-DIRECT];
-    free(indirect_first);
+    sector = inode->data.indirect == 0 ? 0
+             : block_map_lookup(inode, MAP_LEAF, inode->data.indirect,
+                                idx - DIRECT);
   }
   else if(idx<DIRECT + INDIRECT + INDIRECT*INDIRECT)
   {
-    struct indirect_disk *indirect_first = (struct indirect_disk *)malloc(sizeof(struct indirect_disk));
-    cache_read_from_buf(inode->data.double_indirect, indirect_first);
     int indirect_second_idx = (idx - DIRECT - INDIRECT) / INDIRECT;
     int indirect_second_ofs = (idx - DIRECT - INDIRECT) % INDIRECT;
-    struct indirect_disk *indirect_second = (struct indirect_disk *)malloc(sizeof(struct indirect_disk));
-    cache_read_from_buf(indirect_first->data[indirect_second_idx], indirect_second);
-    sector = indirect_second->data[indirect_second_ofs];
-    free(indirect_second);
-    free(indirect_first);
+    sector = inode->data.double_indirect == 0 ? 0
+             : block_map_lookup(inode, MAP_DOUBLE,
+                                inode->data.double_indirect,
+                                indirect_second_idx);
+    if(sector != 0)
+      sector = block_map_lookup(inode, MAP_LEAF, sector, indirect_second_ofs);
   }
   else
   {
@@ -135,18 +222,127 @@ index_to_sector(struct inode *inode, block_sector_t idx)
   return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the buffer cache class of INODE's data. */
+static enum cache_class
+inode_class (const struct inode *inode)
+{
+  if (inode->sector == FREE_MAP_SECTOR)
+    return CACHE_FREE_MAP;
+  return inode->data.is_dir ? CACHE_DIR : CACHE_DATA;
+}
+
+/* Returns entry OFS of the indirect block at SECTOR, through
+  SLOT of INODE's block map. The slot is refilled from the buffer
+  cache if it holds another block. Falls back to indirect_lookup()
+  if the block map can't be allocated. */
+static block_sector_t
+block_map_lookup(struct inode *inode, enum block_map_slot slot,
+                 block_sector_t sector, size_t ofs)
+{
+  struct block_map *map = inode->map;
+  block_sector_t result;
+
+  if(map == NULL)
+  {
+    /* inode_lock keeps two threads from both allocating it. */
+    inode_acquire();
+    map = inode->map;
+    if(map == NULL && (map = malloc(sizeof *map)) != NULL)
+    {
+      lock_init(&map->lock);
+      for(int i = 0; i < MAP_SLOT_CNT; i++)
+        map->sector[i] = 0;
+      inode->map = map;
+    }
+    inode_release();
+    if(map == NULL)
+      return indirect_lookup(sector, ofs);
+  }
+
+  lock_acquire(&map->lock);
+  if(map->sector[slot] != sector)
+  {
+    cache_read_from_buf(sector, CACHE_INDEX, &map->block[slot]);
+    map->sector[slot] = sector;
+  }
+  result = map->block[slot].data[ofs];
+  lock_release(&map->lock);
+  return result;
+}
+
+/* Drops INODE's block map copies, which may be stale once the
+  indirect blocks have changed. */
+static void
+block_map_invalidate(struct inode *inode)
+{
+  struct block_map *map = inode->map;
+
+  if(map == NULL)
+    return;
+  lock_acquire(&map->lock);
+  for(int i = 0; i < MAP_SLOT_CNT; i++)
+    map->sector[i] = 0;
+  lock_release(&map->lock);
+}
+
+/* Returns entry OFS of the indirect block at SECTOR, read in
+  place in the buffer cache. */
+static block_sector_t
+indirect_lookup(block_sector_t sector, size_t ofs)
+{
+  struct cache_e *cache_entry;
+  const struct indirect_disk *disk_indirect
+    = cache_pin(sector, CACHE_INDEX, &cache_entry);
+  block_sector_t result = disk_indirect->data[ofs];
+  cache_unpin(cache_entry);
+  return result;
+}
+
+/* Open inodes, so that opening a single inode twice returns the
+   same `struct inode'.  Hashed by sector into a fixed number of
+   buckets, so that a lookup doesn't walk every open inode. */
+#define INODE_BUCKET_CNT 64
+static struct list open_inodes[INODE_BUCKET_CNT];
+
+/* Up to INODE_CACHE_SIZE inodes that were closed but not removed
+   stay in open_inodes, listed here from least to most recently
+   closed, so that reopening a hot file, such as an executable,
+   doesn't read its inode again.  The least recently closed is
+   freed to make room for another. */
+#define INODE_CACHE_SIZE 16
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Protects open_inodes, closed_inodes and open counts. */
+static struct lock open_inodes_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  for (int i = 0; i < INODE_BUCKET_CNT; i++)
+    list_init (&open_inodes[i]);
+  list_init (&closed_inodes);
+  lock_init (&open_inodes_lock);
   lock_init (&inode_lock);
 }
 
+/* Makes inode_create() use the extent format if EXTENTS is true.
+   Files that already exist keep their format. */
+void
+inode_use_extents (bool extents)
+{
+  use_extents = extents;
+}
+
+/* Makes inode_create() give new directories the hashed format if
+   HASHED is true.  Directories that already exist keep theirs. */
+void
+inode_use_hashed_dirs (bool hashed)
+{
+  use_hashed_dirs = hashed;
+}
+
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
    device.
@@ -175,14 +371,25 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
       disk_inode->is_dir = is_dir;
       disk_inode->is_cwd = 0;
       disk_inode->is_opened = 0;
+      disk_inode->is_hashed = is_dir && use_hashed_dirs;
+      /* A hashed directory fills its buckets in no particular order,
+         leaving holes between them, each of which would cost an
+         extent. */
+      disk_inode->is_extent = use_extents && !disk_inode->is_hashed;
+
+      free_map_batch_begin ();
+      success = disk_inode->is_extent
+                ? extent_alloc(disk_inode, 0, sectors, sector + 1, true)
+                : inode_alloc(disk_inode, sectors, 0, sector + 1, true);
+      if (success)
+        cache_write_from_buf (sector, CACHE_INODE, disk_inode);
+      /* Give back what was allocated before the disk filled up. */
+      else if (disk_inode->is_extent)
+        extent_release (disk_inode);
+      else
+        block_release (disk_inode);
+      free_map_batch_end ();
 
-      if(inode_alloc(disk_inode, sectors, 0))
-      {
-        cache_write_from_buf(sector, disk_inode);
-        success = true;
-      }
-      else PANIC("PANIC WHILE CREATING");
-        
       free (disk_inode);
     }
   return success;
@@ -190,21 +397,34 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+   The inode is read without open_inodes_lock held, so that other
+   inodes can be opened and closed meanwhile.  It is in the open
+   inode list, marked loading, while the read is in progress, and a
+   thread that opens it then waits for the read to finish. */
 struct inode *
 inode_open (block_sector_t sector)
 {
+  struct list *bucket = &open_inodes[sector % INODE_BUCKET_CNT];
   struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open, or was closed
+     recently. */
+  lock_acquire (&open_inodes_lock);
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) 
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          if (inode->open_cnt++ == 0)
+            {
+              list_remove (&inode->closed_elem);
+              closed_cnt--;
+            }
+          while (inode->loading)
+            cond_wait (&inode->loaded, &open_inodes_lock);
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -212,17 +432,29 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL){
+    lock_release (&open_inodes_lock);
     printf("Malloc Failed\n");
     return NULL;
   }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  list_push_front (bucket, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->write_through = false;
+  inode->map = NULL;
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  lock_release (&open_inodes_lock);
+
+  cache_read_from_buf (inode->sector, CACHE_INODE, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -231,7 +463,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -243,7 +479,8 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
+   If this was the last reference to INODE, frees its memory, or
+   keeps it among the recently closed inodes.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) 
@@ -252,25 +489,46 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      lock_release (&open_inodes_lock);
+      return;
+    }
+
+  /* Keep the inode in memory in case it is opened again soon,
+     making room by dropping the least recently closed one. */
+  if (!inode->removed)
+    {
+      list_push_back (&closed_inodes, &inode->closed_elem);
+      if (++closed_cnt <= INODE_CACHE_SIZE)
         {
-          free_map_release (inode->sector, 1);
-          block_sector_t max_idx = byte_to_index(inode->data.length);
-          for(int i = 0; i < max_idx ; i++)
-          {
-            free_map_release (index_to_sector(inode, i), 1);
-          }
+          lock_release (&open_inodes_lock);
+          return;
         }
+      inode = list_entry (list_pop_front (&closed_inodes), struct inode,
+                          closed_elem);
+      closed_cnt--;
+    }
 
-      free (inode); 
+  /* Release resources: remove from inode list and release lock. */
+  list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      free_map_batch_begin ();
+      free_map_release (inode->sector, 1);
+      if (inode->data.is_extent)
+        extent_release (&inode->data);
+      else
+        block_release (&inode->data);
+      free_map_batch_end ();
     }
+
+  free (inode->map);
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -286,7 +544,27 @@ inode_remove (struct inode *inode)
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  return inode_read (inode, buffer, size, offset, false);
+}
+
+/* Same as inode_read_at(), for a caller streaming through a large
+   file that won't read these bytes again soon.  The sectors are
+   left at the cold end of the buffer cache, so they are evicted
+   before the ones other readers depend on. */
+off_t
+inode_read_stream (struct inode *inode, void *buffer, off_t size,
+                   off_t offset) 
+{
+  return inode_read (inode, buffer, size, offset, true);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, for inode_read_at() and inode_read_stream(). */
+static off_t
+inode_read (struct inode *inode, void *buffer_, off_t size, off_t offset,
+            bool stream) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
@@ -294,7 +572,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -307,9 +585,21 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      struct cache_e *cache_entry = cache_load(sector_idx);
-      memcpy(buffer + bytes_read, cache_entry->buf + sector_ofs, chunk_size);
-      
+      /* A hole reads as zeros, without touching the disk. */
+      if(sector_idx == 0)
+        memset(buffer + bytes_read, 0, chunk_size);
+      else
+      {
+        struct cache_e *cache_entry;
+        uint8_t *data = cache_pin(sector_idx, inode_class(inode),
+                                  &cache_entry);
+        memcpy(buffer + bytes_read, data + sector_ofs, chunk_size);
+        if(stream)
+          cache_unpin_cold(cache_entry);
+        else
+          cache_unpin(cache_entry);
+      }
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
@@ -319,6 +609,26 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Queues the sectors that hold SIZE bytes of INODE, starting at
+   OFFSET, for the read-ahead thread.  The sectors are found
+   through INODE's block map, so they needn't be adjacent on
+   disk.  Bytes past the end of the file, and holes, are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  block_sector_t idx;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (idx = byte_to_index (offset); idx < bytes_to_sectors (end); idx++)
+    {
+      block_sector_t sector = index_to_sector (inode, idx);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -330,27 +640,48 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  bool extended = false;
+  off_t length = inode->data.length;
+  off_t end = offset + size > length ? offset + size : length;
+
+  /* Sectors this write covers whole, which need no zeroing if they
+     have to be allocated. */
+  size_t full_from = DIV_ROUND_UP(offset, BLOCK_SECTOR_SIZE);
+  size_t full_to = (offset + size) / BLOCK_SECTOR_SIZE;
+  bool allocated = false;
 
   if (inode->deny_write_cnt)
     return 0;
 
-  byte_to_sector(inode, offset+size, true);
-  if(inode->data.length < offset+size)
-  {
-    inode->data.length = offset+size;
-    extended = true;
-  }
-  cache_write_from_buf(inode->sector, &inode->data);
-
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
+      block_sector_t sector_idx = index_to_sector (inode,
+                                                   byte_to_index (offset));
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
+      /* Sectors are only allocated when first written, so growing
+         the file, even far past its end, leaves a hole. Fill this
+         one, along with the holes right after it that the write
+         also reaches. */
+      if(sector_idx == 0)
+      {
+        size_t idx = byte_to_index(offset);
+        size_t last = byte_to_index(offset + size - 1);
+        size_t cnt = 1;
+
+        while(idx + cnt <= last && index_to_sector(inode, idx + cnt) == 0)
+          cnt++;
+        sector_alloc(inode, idx, cnt, full_from, full_to);
+        sector_idx = index_to_sector(inode, idx);
+        allocated = true;
+
+        /* Out of space: the write stops short. */
+        if(sector_idx == 0)
+          break;
+      }
+
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = end - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -359,9 +690,18 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      struct cache_e * cache_entry = cache_load(sector_idx);
-      memcpy (cache_entry->buf + sector_ofs, buffer + bytes_written, chunk_size);
-      cache_entry->dirty = true;
+      /* A sector written whole needn't be read in first. */
+      struct cache_e *cache_entry;
+      uint8_t *data = chunk_size == BLOCK_SECTOR_SIZE
+                      ? cache_pin_new(sector_idx, inode_class(inode),
+                                      &cache_entry)
+                      : cache_pin(sector_idx, inode_class(inode),
+                                  &cache_entry);
+      memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_mark_dirty(cache_entry);
+      if(inode->write_through)
+        cache_write_back(cache_entry);
+      cache_unpin(cache_entry);
 
       /* Advance. */
       size -= chunk_size;
@@ -369,6 +709,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
+  /* Only growth and filled holes change the on-disk inode. The new
+     length is set once the data is in place, so that readers never
+     see the new sectors before they are written, and only as far as
+     the write got. */
+  if(bytes_written > 0 && offset > inode->data.length)
+    inode->data.length = offset;
+  if(inode->data.length != length || allocated)
+    inode_persist(inode);
+
   return bytes_written;
 }
 
@@ -392,6 +741,15 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Makes every later write to INODE go to disk before
+   inode_write_at() returns, instead of waiting in the buffer
+   cache for write-back. */
+void
+inode_set_write_through (struct inode *inode)
+{
+  inode->write_through = true;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
@@ -399,11 +757,91 @@ inode_length (const struct inode *inode)
   return inode->data.length;
 }
 
+/* Grows DISK_INODE from IDX_OFS to IDX_OFS + SECTORS sectors in the
+  block pointer format. The new data sectors and the index blocks
+  they need are reserved up front, as one run at or after GOAL if
+  the free map has one, and handed out in file order. The data
+  sectors are zeroed if ZERO is true, and left as they are for a
+  caller that will overwrite them otherwise. */
 bool
-inode_alloc(struct inode_disk* disk_inode, size_t sectors, int idx_ofs)
+inode_alloc(struct inode_disk* disk_inode, size_t sectors, int idx_ofs,
+            block_sector_t goal, bool zero)
+{
+  struct sector_run run;
+  bool success;
+
+  run.next = goal;
+  run.left = 0;
+  run.want = sectors + index_sectors(idx_ofs, sectors);
+  run.zero = zero;
+  run.full = false;
+  success = inode_alloc_blocks(disk_inode, sectors, idx_ofs, &run);
+
+  /* Give back whatever wasn't needed. */
+  if(run.left > 0)
+    free_map_release(run.next, run.left);
+  return success;
+}
+
+/* Returns how many index blocks growing a file from IDX_OFS to
+  IDX_OFS + SECTORS sectors allocates: the indirect block, the
+  doubly indirect block and the indirect blocks under it that
+  inode_alloc_blocks() starts fresh. */
+static size_t
+index_sectors(size_t idx_ofs, size_t sectors)
+{
+  size_t end = idx_ofs + sectors;
+  size_t base = DIRECT + INDIRECT;
+  size_t cnt = 0;
+
+  if(end > DIRECT && idx_ofs <= DIRECT)
+    cnt++;
+  if(end > base)
+  {
+    size_t first = idx_ofs <= base ? 0 : DIV_ROUND_UP(idx_ofs - base, INDIRECT);
+    if(idx_ofs <= base)
+      cnt++;
+    cnt += DIV_ROUND_UP(end - base, INDIRECT) - first;
+  }
+  return cnt;
+}
+
+/* Hands out the next sector of RUN in *SECTORP, reserving another
+  run right after the last one when it is used up. The run is as
+  long as what is still wanted if the free map has such a run, and
+  is halved until one is found otherwise. Returns false, and marks
+  RUN full, if the disk is full. */
+static bool
+sector_run_take(struct sector_run *run, block_sector_t *sectorp)
 {
-  static char zeros[BLOCK_SECTOR_SIZE];
+  if(run->left == 0)
+  {
+    size_t cnt = run->want > 0 ? run->want : 1;
+    while(!free_map_allocate_near(run->next, cnt, &run->next))
+    {
+      if(cnt == 1)
+      {
+        run->full = true;
+        return false;
+      }
+      cnt /= 2;
+    }
+    run->left = cnt;
+  }
+  *sectorp = run->next++;
+  run->left--;
+  if(run->want > 0)
+    run->want--;
+  return true;
+}
 
+/* Does the work of inode_alloc(), taking sectors from RUN. If the
+  disk fills up, returns false with the sectors taken so far left
+  in place, so that the file keeps them and the rest stay holes. */
+static bool
+inode_alloc_blocks(struct inode_disk* disk_inode, size_t sectors, int idx_ofs,
+                   struct sector_run *run)
+{
   if(sectors == 0) return true;
 
   /* Allocate direct inode_disk to filesys blocks */
@@ -411,12 +849,13 @@ inode_alloc(struct inode_disk* disk_inode, size_t sectors, int idx_ofs)
                           idx_ofs + sectors : DIRECT;
   for(int i = idx_ofs; i<direct_sectors ; i++)
   { 
-    if(free_map_allocate (1, disk_inode->direct + i))
+    if(sector_run_take (run, disk_inode->direct + i))
     {
-      cache_write_from_buf(disk_inode->direct[i], zeros);
+      if(run->zero)
+        cache_zero(disk_inode->direct[i], CACHE_DATA);
       sectors--;
     }
-    else PANIC("Failed at single indirect_alloc");
+    else return false;
   }
 
   if(sectors == 0) return true;
@@ -425,38 +864,21 @@ inode_alloc(struct inode_disk* disk_inode, size_t sectors, int idx_ofs)
   idx_ofs = 0 > idx_ofs-DIRECT ? 0 : idx_ofs-DIRECT;
 
   /* Allocate new sector for indirect_disk, only when it is newly declared
-    We can know it by idx_ofs. If it is 0, it means it started allocation
-    from direct sectors. Therefore, there is no sector for indirect_disk
-    */
-  struct indirect_disk* disk_indirect = calloc(1, sizeof *disk_indirect);
-  /* If idx_ofs is not zero,
-    just read the existing indirect_disk from sector
+    We can know it by its sector, which stays 0 until then. Because of
+    holes, that may be so even if the range starts partway through it.
     */
-  if(idx_ofs != 0)
-  {
-    cache_read_from_buf(disk_inode->indirect, disk_indirect);
-  }
-
-  /* Fill in the elements of disk_indirect */
-  sectors = indirect_alloc(disk_indirect, sectors, idx_ofs);
-  
-  /* Allocate indirect inode_disk to filesys blocks */
-  block_sector_t sector;
-  if(idx_ofs == 0)
-  {
-    if(free_map_allocate(1, &sector))
-    {
-      disk_inode->indirect = sector;
-    }
-    else  PANIC("Failed at single indirect_alloc");
-  }
-  /* If the indirect disk already exists, obtain it */
-  else
+  if(idx_ofs < INDIRECT)
   {
-    sector = disk_inode->indirect;
+    bool fresh = disk_inode->indirect == 0;
+    if(fresh && !sector_run_take(run, &disk_inode->indirect))
+      return false;
+
+    /* Fill in the elements of disk_indirect, in place in the cache */
+    sectors = indirect_fill(disk_inode->indirect, fresh, sectors, idx_ofs,
+                            run);
+    if(run->full)
+      return false;
   }
-  cache_write_from_buf(sector, disk_indirect);
-  free(disk_indirect);
 
   if(sectors == 0) return true;
 
@@ -470,126 +892,306 @@ inode_alloc(struct inode_disk* disk_inode, size_t sectors, int idx_ofs)
   idx_ofs = 0 > idx_ofs-INDIRECT ? 0 : idx_ofs-INDIRECT;
 
   /* This allocates double indirect sectors
-    First, calloc an indirect_disk to store the double_indirect
+    First, pin the double_indirect disk in the cache, allocating it
+    if it is newly declared.
   */
-  struct indirect_disk* double_indirect_disk
-  = calloc(1, sizeof *double_indirect_disk);
-  if(idx_ofs != 0)
+  bool fresh_double = disk_inode->double_indirect == 0;
+  if(fresh_double)
   {
-    cache_read_from_buf(disk_inode->double_indirect, double_indirect_disk);
+    if(!sector_run_take(run, &disk_inode->double_indirect))
+      return false;
   }
-
-  /* Store the idx_ofs to decide wheter to free_map_alloc */
-  int idx_ofs_double = idx_ofs;
+  struct cache_e *double_entry;
+  struct indirect_disk* double_indirect_disk
+    = fresh_double
+      ? cache_pin_new(disk_inode->double_indirect, CACHE_INDEX, &double_entry)
+      : cache_pin(disk_inode->double_indirect, CACHE_INDEX, &double_entry);
+  if(fresh_double)
+    memset(double_indirect_disk, 0, sizeof *double_indirect_disk);
 
   /* Iterate and allocate indirect disks */
-  for(int i = idx_ofs / INDIRECT; i<DIV_ROUND_UP(sectors, INDIRECT); i++)
+  for(int i = idx_ofs / INDIRECT; sectors > 0 && !run->full && i < INDIRECT;
+      i++)
   {
     /* Make idx_ofs as a idx_ofs for a single indirect disk */
     idx_ofs = idx_ofs % INDIRECT;
-    struct indirect_disk* disk_indirect = calloc(1, sizeof *disk_indirect);
-    
-    if(idx_ofs != 0)
-    {
-      cache_read_from_buf(double_indirect_disk->data[i], disk_indirect);
-    }
-  
-    /* Fill in the elements of disk_indirect */
-    sectors = indirect_alloc(disk_indirect, sectors, idx_ofs);
-    
+
     /* Allocate indirect inode_disk to filesys blocks */
-    block_sector_t sector;
-    if(idx_ofs == 0){
-      if(free_map_allocate(1, &sector))
-      {
-        double_indirect_disk->data[i] = sector;
-      }
-      else PANIC("PANIC");
-    }
-    else
-    {
-      sector = double_indirect_disk->data[i];
-    }    
-    cache_write_from_buf(sector, disk_indirect);
-    free(disk_indirect);
-    
+    bool fresh = double_indirect_disk->data[i] == 0;
+    if(fresh && !sector_run_take(run, &double_indirect_disk->data[i]))
+      break;
+
+    /* Fill in the elements of disk_indirect */
+    sectors = indirect_fill(double_indirect_disk->data[i], fresh,
+                            sectors, idx_ofs, run);
+
     /* Now make the idx_ofs to 0, since the next indirect disks will
       always be allocated from start
       */
     idx_ofs = 0;
   }
-
-  /* Save the double indirect disk to block and store it in
-    inode_disk structure
-   */
-  if(idx_ofs_double == 0)
-  {
-    if(free_map_allocate(1, &sector))
-    {
-      disk_inode->double_indirect = sector; 
-    }
-    else PANIC("PANIC");
-  }
-  else
-  {
-    sector = disk_inode->double_indirect;
-  }
-  cache_write_from_buf(sector, double_indirect_disk);
-  free(double_indirect_disk);
+  cache_mark_dirty(double_entry);
+  cache_unpin(double_entry);
 
   if(sectors == 0) return true;
   
   return false;
 }
 
+/* Allocates up to SECTORS data sectors into the indirect block at
+  SECTOR, from entry IDX_OFS on, and returns how many are left.
+  The block is changed in place in the cache; FRESH means it was
+  just allocated, so its old contents are cleared first. */
+static size_t
+indirect_fill(block_sector_t sector, bool fresh, size_t sectors, int idx_ofs,
+              struct sector_run *run)
+{
+  struct cache_e *cache_entry;
+  struct indirect_disk *disk_indirect
+    = fresh ? cache_pin_new(sector, CACHE_INDEX, &cache_entry)
+            : cache_pin(sector, CACHE_INDEX, &cache_entry);
+
+  if(fresh)
+    memset(disk_indirect, 0, sizeof *disk_indirect);
+  sectors = indirect_alloc(disk_indirect, sectors, idx_ofs, run);
+  cache_mark_dirty(cache_entry);
+  cache_unpin(cache_entry);
+  return sectors;
+}
+
 /* This allocates one indirect_disk to one sector in block
   And returns the remaining sectors after allocating them.
+  Stops early, leaving RUN marked full, if the disk fills up.
 */
 size_t
-indirect_alloc(struct indirect_disk* disk_indirect, size_t sectors, int idx_ofs)
+indirect_alloc(struct indirect_disk* disk_indirect, size_t sectors, int idx_ofs,
+               struct sector_run *run)
 {
-  static char zeros[BLOCK_SECTOR_SIZE];
-  
   /* Allocate each indirect sectors */
   size_t indirect_sectors = idx_ofs + sectors < INDIRECT ?
                             idx_ofs + sectors : INDIRECT;
   for(int i = idx_ofs; i<indirect_sectors; i++)
   {
-    if(free_map_allocate(1, disk_indirect->data + i))
+    if(sector_run_take(run, disk_indirect->data + i))
     {
-      cache_write_from_buf(disk_indirect->data[i], zeros);
+      if(run->zero)
+        cache_zero(disk_indirect->data[i], CACHE_DATA);
       sectors--;
     }
     else
+      break;
+  }
+  return sectors;
+}
+
+/* Maps sectors IDX through IDX + SECTORS - 1 of a file in the
+   extent format, which must all be holes, to newly allocated
+   sectors, zeroed if ZERO is true.  The extent that ends right
+   before IDX grows in place as long as the sectors right after it
+   are free; otherwise a new extent is inserted, in file order,
+   with the longest free run, up to what is still needed, that
+   free_map_allocate_near() can find at or after the end of the
+   previous extent, or GOAL if there is none.  An extent that comes
+   to end right where the next one begins, on disk as in the file,
+   is merged with it, so that filling the hole between two extents
+   gives one back.  Returns false if the disk is full or DISK_INODE
+   runs out of extents, with the sectors allocated so far left in
+   place. */
+static bool
+extent_alloc (struct inode_disk *disk_inode, block_sector_t idx,
+              size_t sectors, block_sector_t goal, bool zero)
+{
+  struct extent *extents = disk_inode->extents;
+
+  while (sectors > 0)
+    {
+      struct extent *prev = NULL, *cur;
+      block_sector_t start = 0;
+      size_t run = 0;
+      int pos = 0;
+
+      /* Extents before POS lie wholly before IDX. */
+      while (pos < disk_inode->extent_cnt && extents[pos].idx < idx)
+        pos++;
+      if (pos > 0)
+        {
+          prev = &extents[pos - 1];
+          start = prev->start + prev->length;
+          if (prev->idx + prev->length == idx)
+            run = free_map_extend (start, sectors);
+        }
+      if (run > 0)
+        {
+          prev->length += run;
+          cur = prev;
+        }
+      else
+        {
+          if (disk_inode->extent_cnt == EXTENT_CNT)
+            return false;
+          if (prev != NULL)
+            goal = start;
+          for (run = sectors; !free_map_allocate_near (goal, run, &start);
+               run /= 2)
+            if (run == 1)
+              return false;
+          memmove (&extents[pos + 1], &extents[pos],
+                   (disk_inode->extent_cnt - pos) * sizeof *extents);
+          disk_inode->extent_cnt++;
+          extents[pos].idx = idx;
+          extents[pos].start = start;
+          extents[pos].length = run;
+          cur = &extents[pos];
+        }
+
+      if (cur + 1 < extents + disk_inode->extent_cnt
+          && cur->idx + cur->length == cur[1].idx
+          && cur->start + cur->length == cur[1].start)
+        {
+          cur->length += cur[1].length;
+          memmove (cur + 1, cur + 2,
+                   (extents + disk_inode->extent_cnt - (cur + 2))
+                   * sizeof *extents);
+          disk_inode->extent_cnt--;
+        }
+
+      if (zero)
+        for (size_t i = 0; i < run; i++)
+          cache_zero (start + i, CACHE_DATA);
+      idx += run;
+      sectors -= run;
+    }
+  return true;
+}
+
+/* Returns the disk sector that holds sector IDX of a file in the
+   extent format, by binary search over the extents of DISK_INODE,
+   or 0 if IDX falls in a hole between them. */
+static block_sector_t
+extent_lookup (const struct inode_disk *disk_inode, block_sector_t idx)
+{
+  const struct extent *extents = disk_inode->extents;
+  int lo = 0, hi = disk_inode->extent_cnt;
+
+  if (hi == 0 || idx < extents[0].idx)
+    return 0;
+  /* The last extent that starts at or before IDX is in [LO, HI). */
+  while (hi - lo > 1)
     {
-      PANIC("Failed at single indirect_alloc");
+      int mid = (lo + hi) / 2;
+      if (extents[mid].idx <= idx)
+        lo = mid;
+      else
+        hi = mid;
     }
+  if (idx - extents[lo].idx >= extents[lo].length)
+    return 0;
+  return extents[lo].start + (idx - extents[lo].idx);
+}
+
+/* Releases the sectors of every extent of DISK_INODE. */
+static void
+extent_release (const struct inode_disk *disk_inode)
+{
+  for (int i = 0; i < disk_inode->extent_cnt; i++)
+    free_map_release (disk_inode->extents[i].start,
+                      disk_inode->extents[i].length);
+}
+
+/* Releases the data sectors and index blocks of DISK_INODE, in the
+  block pointer format. Entries of 0 are holes and are skipped. */
+static void
+block_release(const struct inode_disk *disk_inode)
+{
+  for(int i = 0; i < DIRECT; i++)
+    if(disk_inode->direct[i] != 0)
+      free_map_release(disk_inode->direct[i], 1);
+
+  if(disk_inode->indirect != 0)
+    indirect_release(disk_inode->indirect);
+
+  if(disk_inode->double_indirect != 0)
+  {
+    struct cache_e *cache_entry;
+    const struct indirect_disk *double_indirect_disk
+      = cache_pin(disk_inode->double_indirect, CACHE_INDEX, &cache_entry);
+    for(int i = 0; i < INDIRECT; i++)
+      if(double_indirect_disk->data[i] != 0)
+        indirect_release(double_indirect_disk->data[i]);
+    cache_unpin(cache_entry);
+    free_map_release(disk_inode->double_indirect, 1);
   }
-  return sectors;
 }
 
-/* This function is called in bytes_to_sectors.
-  If the file wants to write to the bytes beyond the length,
-  this function calculates how many sectors should be allocated,
-  and allocate them from idx_ofs.
+/* Releases the indirect block at SECTOR and the data sectors it
+  points to. */
+static void
+indirect_release(block_sector_t sector)
+{
+  struct cache_e *cache_entry;
+  const struct indirect_disk *disk_indirect
+    = cache_pin(sector, CACHE_INDEX, &cache_entry);
+  for(int i = 0; i < INDIRECT; i++)
+    if(disk_indirect->data[i] != 0)
+      free_map_release(disk_indirect->data[i], 1);
+  cache_unpin(cache_entry);
+  free_map_release(sector, 1);
+}
 
-  idx_ofs will be from current inode length
+/* Allocates sectors IDX through IDX + SECTORS - 1 of INODE, which
+  must all be holes, on the first write to them.
 
-  After allocation, update inode length
+  The new sectors are zeroed, except for those with indices in
+  [SKIP_FROM, SKIP_TO), which the caller is about to overwrite
+  whole. The caller updates the inode length.
+
+  Returns false if the disk, or the extent list, fills up first.
+  The sectors allocated by then stay with the file, zeroed, since
+  the caller may not get to write them, and the rest stay holes.
   */
 bool
-sector_alloc(struct inode* inode, size_t sectors)
+sector_alloc(struct inode* inode, size_t idx, size_t sectors,
+             size_t skip_from, size_t skip_to)
 {
-  size_t length_idx = bytes_to_sectors(inode->data.length);
-  if(inode_alloc(&inode->data, sectors, length_idx))
+  size_t start = idx;
+  size_t end = idx + sectors;
+  bool success = true;
+
+  free_map_batch_begin();
+  while(success && idx < end)
   {
-    return true;
+    /* Allocate up to the next edge of the skipped range. */
+    bool zero = idx < skip_from || idx >= skip_to;
+    size_t stop = idx < skip_from ? skip_from
+                  : idx < skip_to ? skip_to : end;
+    if(stop > end)
+      stop = end;
+
+    /* Keep the file's sectors together: go right after the one
+       before, unless that is a hole too. */
+    block_sector_t prev = idx > 0 ? index_to_sector(inode, idx - 1) : 0;
+    block_sector_t goal = prev != 0 ? prev + 1 : inode->sector + 1;
+
+    success = inode->data.is_extent
+              ? extent_alloc(&inode->data, idx, stop - idx, goal, zero)
+              : inode_alloc(&inode->data, stop - idx, idx, goal, zero);
+    if(success)
+      block_map_invalidate(inode);
+    idx = stop;
   }
-  else
+  free_map_batch_end();
+  if(!success)
   {
-    PANIC("Failed at growing");
+    block_map_invalidate(inode);
+    for(idx = skip_from > start ? skip_from : start;
+        idx < skip_to && idx < end; idx++)
+    {
+      block_sector_t sector = index_to_sector(inode, idx);
+      if(sector != 0)
+        cache_zero(sector, CACHE_DATA);
+    }
   }
-  return false;
+  return success;
 }
 
 void
@@ -616,6 +1218,45 @@ inode_dir(struct inode* inode)
   return inode->data.is_dir;
 }
 
+/* Changes the count of file descriptors open on directory INODE
+  by DELTA. */
+void
+inode_dir_adjust_opened(struct inode* inode, int delta)
+{
+  inode->data.is_opened += delta;
+  inode_persist(inode);
+}
+
+/* Changes the count of processes whose working directory is
+  INODE by DELTA. */
+void
+inode_dir_adjust_cwd(struct inode* inode, int delta)
+{
+  inode->data.is_cwd += delta;
+  inode_persist(inode);
+}
+
+/* Copies INODE's data, after a change, to its sector in the buffer
+  cache, or to disk for a write-through inode. The in-memory copy
+  is the one that counts while the inode is open or among the
+  recently closed ones; the sector is only read again once it has
+  been dropped from memory. */
+static void
+inode_persist(struct inode* inode)
+{
+  if(inode->write_through)
+    cache_write_through(inode->sector, CACHE_INODE, &inode->data);
+  else
+    cache_write_from_buf(inode->sector, CACHE_INODE, &inode->data);
+}
+
+/* Returns true if INODE is a directory in the hashed format. */
+bool
+inode_is_hashed(const struct inode* inode)
+{
+  return inode->data.is_hashed;
+}
+
 int
 inode_dir_opened(struct inode* inode)
 {
@@ -14,11 +14,16 @@ struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_use_extents (bool);
+void inode_use_hashed_dirs (bool);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+off_t inode_read_stream (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_set_write_through (struct inode *);
 
 block_sector_t byte_to_index(off_t);
 block_sector_t index_to_sector(struct inode *, block_sector_t);
@@ -28,7 +33,10 @@ void inode_release();
 
 block_sector_t inode_sec(struct inode*);
 bool inode_dir(struct inode*);
+bool inode_is_hashed(const struct inode*);
 int inode_dir_opened(struct inode* inode);
 int inode_dir_cwd(struct inode* inode);
+void inode_dir_adjust_opened(struct inode* inode, int delta);
+void inode_dir_adjust_cwd(struct inode* inode, int delta);
 int inode_open_cnt(struct inode* inode);
 #endif /* filesys/inode.h */
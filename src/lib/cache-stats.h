@@ -0,0 +1,24 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache counters since boot, as returned by the
+   cache_stats() system call and printed at power-off.
+   Counts are in cache entries, each of which holds one or more
+   sectors depending on the -cache-block kernel option. */
+struct cache_stats
+  {
+    long long hits;             /* Demand accesses found cached. */
+    long long misses;           /* Demand accesses read from disk. */
+    long long coalesced;        /* Hits that waited for a read
+                                   already in flight. */
+    long long evictions;        /* Entries evicted to make room. */
+    long long write_backs;      /* Dirty entries written to disk. */
+    long long ra_issued;        /* Entries read by read-ahead. */
+    long long ra_used;          /* ...later accessed on demand. */
+    long long ra_wasted;        /* ...evicted without being accessed. */
+    long long lock_acquires;    /* Acquisitions of the cache lock. */
+    long long lock_contended;   /* ...that had to wait for it. */
+    long long lock_wait_ms;     /* Total time spent waiting for it. */
+  };
+
+#endif /* lib/cache-stats.h */
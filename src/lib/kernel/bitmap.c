@@ -300,11 +300,29 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 
   if (cnt <= b->bit_cnt) 
     {
+      elem_type none = value ? 0 : (elem_type) -1;
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+      while (i <= last)
+        {
+          size_t j;
+
+          /* Skip whole elements that have no bit set to VALUE. */
+          if (i % ELEM_BITS == 0 && b->bits[elem_idx (i)] == none)
+            {
+              i += ELEM_BITS;
+              continue;
+            }
+
+          /* Measure the run of VALUE bits starting at I.  If it is
+             too short, no group can start before the bit that ended
+             it, so resume the search just past that bit. */
+          for (j = i; j < i + cnt && bitmap_test (b, j) == value; j++)
+            continue;
+          if (j == i + cnt)
+            return i;
+          i = j + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -182,3 +182,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+void
+cache_stats (struct cache_stats *stats)
+{
+  syscall1 (SYS_CACHE_STATS, stats);
+}
@@ -0,0 +1,49 @@
+/* Checks that the cache_stats system call reports the buffer
+   cache's counters: reading the start of a file twice the size of
+   the default buffer cache, after writing all of it, has to miss,
+   and reading the same bytes again right away has to hit.  The
+   counters are copied into pages the program hasn't touched yet,
+   which must be brought in rather than fault the call. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK_SIZE 512
+#define FILE_SIZE (128 * CHUNK_SIZE)
+
+static char buf[FILE_SIZE];
+static struct cache_stats before, middle, after;
+
+void
+test_main (void) 
+{
+  int fd;
+
+  memset (buf, 0xa5, sizeof buf);
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+
+  msg ("read start of \"data\"");
+  cache_stats (&before);
+  seek (fd, 0);
+  if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+    fail ("read of \"data\" failed");
+  cache_stats (&middle);
+  if (middle.misses <= before.misses)
+    fail ("misses went from %lld to %lld", before.misses, middle.misses);
+
+  msg ("read start of \"data\" again");
+  seek (fd, 0);
+  if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+    fail ("read of \"data\" failed");
+  cache_stats (&after);
+  if (after.hits <= middle.hits)
+    fail ("hits went from %lld to %lld", middle.hits, after.hits);
+
+  msg ("close \"data\"");
+  close (fd);
+  CHECK (remove ("data"), "remove \"data\"");
+}
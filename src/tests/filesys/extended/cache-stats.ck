@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-stats) begin
+(cache-stats) create "data"
+(cache-stats) open "data"
+(cache-stats) write "data"
+(cache-stats) read start of "data"
+(cache-stats) read start of "data" again
+(cache-stats) close "data"
+(cache-stats) remove "data"
+(cache-stats) end
+EOF
+pass;
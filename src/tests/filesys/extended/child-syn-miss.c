@@ -0,0 +1,42 @@
+/* Child process for syn-miss.
+   Reads the whole test file a sector-sized chunk at a time,
+   checking each chunk as it goes. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-miss.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-miss";
+
+static char buf1[BUF_SIZE];
+static char buf2[CHUNK_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  int fd;
+  size_t ofs;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf1, sizeof buf1);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < sizeof buf1; ofs += CHUNK_SIZE) 
+    {
+      CHECK (read (fd, buf2, CHUNK_SIZE) == CHUNK_SIZE,
+             "read %d bytes at offset %zu in \"%s\"",
+             CHUNK_SIZE, ofs, file_name);
+      compare_bytes (buf2, buf1 + ofs, CHUNK_SIZE, ofs, file_name);
+    }
+  close (fd);
+
+  return child_idx;
+}
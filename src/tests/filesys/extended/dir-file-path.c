@@ -0,0 +1,17 @@
+/* Tries to use a file as a directory in the middle of a path,
+   which must fail without touching the file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  CHECK (create ("abc", 0), "create \"abc\"");
+  CHECK (!create ("abc/x", 0), "create \"abc/x\" (must return false)");
+  CHECK (!mkdir ("abc/x"), "mkdir \"abc/x\" (must return false)");
+  CHECK (open ("abc/x") == -1, "open \"abc/x\" (must return -1)");
+  CHECK (!remove ("abc/x"), "remove \"abc/x\" (must return false)");
+  CHECK (!chdir ("abc"), "chdir \"abc\" (must return false)");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-file-path) begin
+(dir-file-path) create "abc"
+(dir-file-path) create "abc/x" (must return false)
+(dir-file-path) mkdir "abc/x" (must return false)
+(dir-file-path) open "abc/x" (must return -1)
+(dir-file-path) remove "abc/x" (must return false)
+(dir-file-path) chdir "abc" (must return false)
+(dir-file-path) end
+EOF
+pass;
@@ -0,0 +1,60 @@
+/* Makes a chain of nested directories whose full path is longer
+   than 128 bytes, and creates, opens, writes, reads and removes a
+   file at its bottom through that path, then removes the
+   directories through their paths too. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 12
+
+/* Each level adds "/directory-NN", 13 bytes. */
+static char path[DEPTH * 13 + 16];
+static size_t dir_len[DEPTH];
+
+void
+test_main (void) 
+{
+  char buf[5];
+  int fd;
+  int i;
+
+  for (i = 0; i < DEPTH; i++)
+    {
+      size_t len = strlen (path);
+      snprintf (path + len, sizeof path - len, "/directory-%02d", i);
+      if (!mkdir (path))
+        fail ("mkdir \"%s\" failed", path);
+      dir_len[i] = strlen (path);
+    }
+  msg ("made %d nested directories", DEPTH);
+
+  strlcat (path, "/file", sizeof path);
+  CHECK (create (path, 0), "create file, %zu-byte path", strlen (path));
+  CHECK ((fd = open (path)) > 1, "open file");
+  CHECK (write (fd, "hello", 5) == 5, "write file");
+  msg ("close file");
+  close (fd);
+
+  path[dir_len[DEPTH - 1]] = '\0';
+  CHECK (chdir (path), "chdir to bottom directory");
+  CHECK ((fd = open ("file")) > 1, "open file from there");
+  CHECK (read (fd, buf, sizeof buf) == 5 && !memcmp (buf, "hello", 5),
+         "read file");
+  msg ("close file");
+  close (fd);
+  CHECK (chdir ("/"), "chdir \"/\"");
+
+  strlcat (path, "/file", sizeof path);
+  CHECK (remove (path), "remove file");
+  for (i = DEPTH - 1; i >= 0; i--)
+    {
+      path[dir_len[i]] = '\0';
+      if (!remove (path))
+        fail ("remove \"%s\" failed", path);
+    }
+  msg ("removed %d nested directories", DEPTH);
+}
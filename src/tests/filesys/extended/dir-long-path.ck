@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-long-path) begin
+(dir-long-path) made 12 nested directories
+(dir-long-path) create file, 161-byte path
+(dir-long-path) open file
+(dir-long-path) write file
+(dir-long-path) close file
+(dir-long-path) chdir to bottom directory
+(dir-long-path) open file from there
+(dir-long-path) read file
+(dir-long-path) close file
+(dir-long-path) chdir "/"
+(dir-long-path) remove file
+(dir-long-path) removed 12 nested directories
+(dir-long-path) end
+EOF
+pass;
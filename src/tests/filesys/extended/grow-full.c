@@ -0,0 +1,77 @@
+/* Grows a file until the disk is full, past the last sector of the
+   disk, and checks that the write then comes up short instead of
+   failing hard, that what was written reads back, and that the
+   space can be used again once the file is removed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 4096
+#define MIN_FULL (1536 * 1024)
+#define REFILL_SIZE (1024 * 1024)
+
+static char buf[BLOCK_SIZE];
+static char rbuf[BLOCK_SIZE];
+
+/* Writes blocks of BUF to FD until one comes up short, and returns
+   the number of bytes written. */
+static size_t
+fill (int fd)
+{
+  size_t total = 0;
+  int ret;
+
+  do
+    {
+      ret = write (fd, buf, BLOCK_SIZE);
+      if (ret < 0 || ret > BLOCK_SIZE)
+        fail ("write returned %d", ret);
+      total += ret;
+    }
+  while (ret == BLOCK_SIZE);
+  return total;
+}
+
+void
+test_main (void) 
+{
+  size_t total, ofs;
+  int fd;
+
+  memset (buf, 0x5a, sizeof buf);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("write \"a\" until the disk is full");
+  total = fill (fd);
+  if (total < MIN_FULL)
+    fail ("disk full after only %zu bytes", total);
+  CHECK (write (fd, buf, BLOCK_SIZE) == 0, "write to full disk");
+  CHECK (filesize (fd) == (int) total, "size of \"a\" matches bytes written");
+
+  msg ("verify \"a\"");
+  seek (fd, 0);
+  for (ofs = 0; ofs < total; ofs += BLOCK_SIZE)
+    {
+      size_t size = total - ofs < BLOCK_SIZE ? total - ofs : BLOCK_SIZE;
+      if (read (fd, rbuf, size) != (int) size)
+        fail ("read %zu bytes at offset %zu in \"a\" failed", size, ofs);
+      if (memcmp (rbuf, buf, size))
+        fail ("\"a\" differs at offset %zu", ofs);
+    }
+  msg ("close \"a\"");
+  close (fd);
+  CHECK (remove ("a"), "remove \"a\"");
+
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  for (ofs = 0; ofs < REFILL_SIZE; ofs += BLOCK_SIZE)
+    if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+      fail ("write to \"b\" at offset %zu failed", ofs);
+  msg ("wrote \"b\" into the freed space");
+  msg ("close \"b\"");
+  close (fd);
+  CHECK (remove ("b"), "remove \"b\"");
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-full) begin
+(grow-full) create "a"
+(grow-full) open "a"
+(grow-full) write "a" until the disk is full
+(grow-full) write to full disk
+(grow-full) size of "a" matches bytes written
+(grow-full) verify "a"
+(grow-full) close "a"
+(grow-full) remove "a"
+(grow-full) create "b"
+(grow-full) open "b"
+(grow-full) wrote "b" into the freed space
+(grow-full) close "b"
+(grow-full) remove "b"
+(grow-full) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"child-syn-miss" => "tests/filesys/extended/child-syn-miss",
+		"data" => [random_bytes (128 * 512)]});
+pass;
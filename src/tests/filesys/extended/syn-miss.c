@@ -0,0 +1,41 @@
+/* Spawns 8 child processes that all read the same file, larger
+   than the buffer cache, from start to end.  They are started
+   together but not kept in step, so they tend to, but need not,
+   miss on the same sectors at the same time.  Each makes sure
+   that the contents are what they should be, and the buffer
+   cache has to report reads that were shared rather than issued
+   again. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-miss.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[BUF_SIZE];
+static struct cache_stats before, after;
+
+#define CHILD_CNT 8
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  int fd;
+
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) > 0, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  cache_stats (&before);
+  exec_children ("child-syn-miss", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+  cache_stats (&after);
+
+  /* A miss on a sector already being read waits for that read. */
+  CHECK (after.coalesced > before.coalesced,
+         "some reads were shared between misses");
+}
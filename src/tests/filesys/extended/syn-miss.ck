@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-miss) begin
+(syn-miss) create "data"
+(syn-miss) open "data"
+(syn-miss) write "data"
+(syn-miss) close "data"
+(syn-miss) exec child 1 of 8: "child-syn-miss 0"
+(syn-miss) exec child 2 of 8: "child-syn-miss 1"
+(syn-miss) exec child 3 of 8: "child-syn-miss 2"
+(syn-miss) exec child 4 of 8: "child-syn-miss 3"
+(syn-miss) exec child 5 of 8: "child-syn-miss 4"
+(syn-miss) exec child 6 of 8: "child-syn-miss 5"
+(syn-miss) exec child 7 of 8: "child-syn-miss 6"
+(syn-miss) exec child 8 of 8: "child-syn-miss 7"
+(syn-miss) wait for child 1 of 8 returned 0 (expected 0)
+(syn-miss) wait for child 2 of 8 returned 1 (expected 1)
+(syn-miss) wait for child 3 of 8 returned 2 (expected 2)
+(syn-miss) wait for child 4 of 8 returned 3 (expected 3)
+(syn-miss) wait for child 5 of 8 returned 4 (expected 4)
+(syn-miss) wait for child 6 of 8 returned 5 (expected 5)
+(syn-miss) wait for child 7 of 8 returned 6 (expected 6)
+(syn-miss) wait for child 8 of 8 returned 7 (expected 7)
+(syn-miss) some reads were shared between misses
+(syn-miss) end
+EOF
+pass;
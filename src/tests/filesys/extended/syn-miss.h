@@ -0,0 +1,11 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_MISS_H
+#define TESTS_FILESYS_EXTENDED_SYN_MISS_H
+
+#define CHUNK_SIZE 512
+
+/* Twice the default buffer cache, so that the readers keep
+   missing in the cache as they go. */
+#define BUF_SIZE (128 * CHUNK_SIZE)
+static const char file_name[] = "data";
+
+#endif /* tests/filesys/extended/syn-miss.h */
@@ -37,6 +37,8 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/inode.h"
+#include "filesys/free-map.h"
 #endif
 #ifdef VM
 #include "vm/frame.h"
@@ -55,6 +57,21 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -cache: Number of sectors in the buffer cache. */
+static size_t cache_sectors = CACHE_SIZE;
+
+/* -cache-block: Sectors per buffer cache entry. */
+static size_t cache_block_sectors = 1;
+
+/* -cache-policy: Buffer cache replacement policy. */
+static enum cache_policy cache_policy = CACHE_CLOCK;
+
+/* -flush-interval, -flush-age, -flush-dirty: Buffer cache flush
+   thread tunables, in milliseconds and sectors. */
+static int flush_interval_ms = 100;
+static int flush_age_ms = 500;
+static size_t flush_dirty_sectors;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -130,7 +147,9 @@ main (void)
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
-  cache_init();
+  cache_flush_configure (flush_interval_ms, flush_age_ms,
+                         flush_dirty_sectors);
+  cache_init (cache_sectors, cache_block_sectors, cache_policy);
   filesys_init (format_filesys);
 #endif
 
@@ -263,6 +282,33 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_sectors = atoi (value);
+      else if (!strcmp (name, "-cache-block"))
+        {
+          cache_block_sectors = atoi (value);
+          if (cache_block_sectors == 0
+              || cache_block_sectors > CACHE_BLOCK_MAX
+              || (cache_block_sectors & (cache_block_sectors - 1)) != 0)
+            PANIC ("-cache-block must be a power of 2 up to %d",
+                   CACHE_BLOCK_MAX);
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          cache_policy = cache_policy_by_name (value != NULL ? value : "");
+          if (cache_policy == CACHE_POLICY_CNT)
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents (true);
+      else if (!strcmp (name, "-hashdirs"))
+        inode_use_hashed_dirs (true);
+      else if (!strcmp (name, "-flush-interval"))
+        flush_interval_ms = atoi (value);
+      else if (!strcmp (name, "-flush-age"))
+        flush_age_ms = atoi (value);
+      else if (!strcmp (name, "-flush-dirty"))
+        flush_dirty_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -331,6 +377,9 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"cachebench", 1, cache_bench},
+      {"allocbench", 1, free_map_bench},
+      {"pathbench", 1, filesys_path_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -380,6 +429,9 @@ usage (void)
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "  cachebench         Measure buffer cache hit latency.\n"
+          "  allocbench         Measure free map allocation latency.\n"
+          "  pathbench          Measure open latency against path depth.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -389,6 +441,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Cache N disk sectors in memory (default 64).\n"
+          "  -cache-block=N     Cache and read N sectors at a time (1, 2, 4, 8).\n"
+          "  -cache-policy=P    Replace cached sectors by P: clock or lru.\n"
+          "  -extents           Store new files' blocks as extents.\n"
+          "  -hashdirs          Give new directories a hashed index.\n"
+          "  -flush-interval=MS Check for old dirty sectors every MS ms (100).\n"
+          "  -flush-age=MS      Write back sectors dirty for MS ms (500).\n"
+          "  -flush-dirty=N     Start writing back at N dirty sectors\n"
+          "                     (default half the cache).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
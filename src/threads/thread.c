@@ -433,6 +433,27 @@ thread_awake (int64_t tick)
   }
 }
 
+/* Alarm Clock - thread_wake
+   Wakes T before its time if it is sleeping in thread_sleep(),
+   and does nothing otherwise. */
+void
+thread_wake (struct thread *t)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&sleep_list); e != list_end (&sleep_list);
+       e = list_next (e))
+    if (e == &t->elem)
+      {
+        list_remove (e);
+        thread_unblock (t);
+        break;
+      }
+  intr_set_level (old_level);
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -182,6 +182,7 @@ void thread_yield (void);
 static int64_t alarm_tick;
 void thread_sleep(int64_t tick);
 void thread_awake(int64_t tick);
+void thread_wake(struct thread *t);
 
 /* Pri Scheduling */
 void pri_sort(struct list *list, struct list_elem *e);
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "lib/user/syscall.h"
 #include "threads/interrupt.h"
@@ -7,6 +8,8 @@
 #include "threads/vaddr.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "userprog/pagedir.h"
 #include "userprog/exception.h"
 #include "vm/page.h"
@@ -155,6 +158,15 @@ syscall_handler (struct intr_frame *f)
       f->eax = Inumber(*(int *)(f->esp+4));
       break;
     }
+    case SYS_CACHE_STATS:
+    {
+      /* Bad address is checked in page fault and will be exit */
+      struct cache_stats *stats = *(struct cache_stats **)(f->esp+4);
+      if(!is_user_vaddr(stats) || !is_user_vaddr((char *)(stats + 1) - 1))
+        Exit(-1);
+      Cache_stats(stats);
+      break;
+    }
   }
 }
 
@@ -446,13 +458,12 @@ Open (const char *file)
   memset (adding, 0, sizeof *adding); //not sure needed
   adding->fd = new_fd;
   
-  struct inode * inode = opening->inode;
+  struct inode * inode = file_get_inode(opening);
 
   if(inode_dir(inode))
   {
     struct dir *opened_dir = dir_open(inode);
-    inode->data.is_opened++;
-    cache_write_from_buf(inode->sector, &inode->data);
+    inode_dir_adjust_opened(inode, 1);
 
     adding->dir = opened_dir;
     adding->file = NULL;
@@ -532,7 +543,7 @@ Write(int fd, const char *buffer, unsigned size)
       return -1;
     
     struct file* paper = list_entry(temp, struct o_file, elem)->file;
-    if(paper->inode->data.is_dir)
+    if(inode_dir(file_get_inode(paper)))
       return -1;
 
     frame_acquire();
@@ -580,9 +591,8 @@ Close (int fd)
       struct inode* inode = list_entry(temp, struct o_file, elem)->dir->inode;
       if(inode != NULL)
       {
-        inode->data.is_opened--;
+        inode_dir_adjust_opened(inode, -1);
       }
-      cache_write_from_buf(inode->sector, &inode->data);
       dir_close(list_entry(temp, struct o_file, elem)->dir);
       list_remove(temp);
     }
@@ -624,15 +634,11 @@ Chdir(const char* dir)
     return false;
   }
 
-  struct inode* inode = thread_current()->cwd->inode;
-  inode->data.is_cwd--;
-  cache_write_from_buf(inode->sector, &inode->data);
+  inode_dir_adjust_cwd(dir_get_inode(thread_current()->cwd), -1);
 
   dir_close(thread_current()->cwd);
   thread_current()->cwd = destination;
-  inode = thread_current()->cwd->inode;
-  inode->data.is_cwd++;
-  cache_write_from_buf(inode->sector, &inode->data);
+  inode_dir_adjust_cwd(dir_get_inode(thread_current()->cwd), 1);
 
   return true;
 } 
@@ -681,9 +687,37 @@ int
 Inumber(int fd)
 {
   struct list_elem* temp = Find_file(fd);
-  int inum = list_entry(temp, struct o_file, elem)->dir->inode->sector;
+  int inum = inode_get_inumber(list_entry(temp, struct o_file, elem)->dir->inode);
   return inum;
 }
+
+/* Samples the buffer cache counters into STATS. They are copied
+  out after cache_lock is released, since touching user memory
+  may fault in a page from the file system. */
+void
+Cache_stats(struct cache_stats *stats)
+{
+  struct cache_stats s;
+
+  cache_get_stats(&s);
+  frame_acquire();
+  for(void *upage = pg_round_down(stats); upage < (void *)(stats + 1);
+      upage += PGSIZE)
+  {
+    if(page_load(upage, thread_current()))
+      pin_frame_by_upage(upage, thread_current());
+  }
+  frame_release();
+  memcpy(stats, &s, sizeof s);
+  frame_acquire();
+  for(void *upage = pg_round_down(stats); upage < (void *)(stats + 1);
+      upage += PGSIZE)
+  {
+    if(lookup_page_table(upage, thread_current()))
+      unpin_frame_by_upage(upage, thread_current());
+  }
+  frame_release();
+}
 /*
 bool
 dir_readdir(struct dir *reading_dir, char *name)
@@ -5,8 +5,6 @@
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
-#define DIRECT 96
-#define INDIRECT 128
 #define NAME_MAX 14
 
 struct dir 
@@ -22,39 +20,6 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-struct file 
-  {
-    struct inode *inode;        /* File's inode. */
-    off_t pos;                  /* Current position. */
-    bool deny_write;            /* Has file_deny_write() been called? */
-  };
-
-struct inode_disk
-  {
-    block_sector_t direct[DIRECT];
-    block_sector_t indirect;
-    block_sector_t double_indirect;
-
-    bool is_dir;
-    int is_opened;
-    int is_cwd;
-
-    off_t length;                       /* File size in bytes. */
-    unsigned magic;                     /* Magic number. */
-
-    char unused[100];
-  };
-
-struct inode 
-  {
-    struct list_elem elem;              /* Element in inode list. */
-    block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
-    bool removed;                       /* True if deleted, false otherwise. */
-    int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
-  };
-
 /* An open file. */
 struct o_file
 {
@@ -91,6 +56,7 @@ bool Mkdir(const char* dir);
 bool Readdir(int fd, char* name);
 bool Isdir(int fd);
 int Inumber(int fd);
+void Cache_stats(struct cache_stats *);
 
 //bool dir_readdir(struct dir *reading_dir, char *name);
 #endif /* userprog/syscall.h */